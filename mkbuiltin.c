@@ -0,0 +1,71 @@
+// mkbuiltin.c
+// 		HIDCAM ma.ke.
+//
+// 		generate perfect hash tables for the built-in registry of sms2mid.h
+// 		run it after any change of builtin[] and replace builtinSeed and 
+// 		builtinSlot in sms2mid.h with the output
+//
+//		tcc mkbuiltin.c
+//		mkbuiltin > builtin.txt
+//
+
+#include "sms2mid.h"		// midi and sms api for simple music script language
+
+#define ENTRIES (int)(sizeof(builtin) / sizeof(builtin[0]))
+
+// print table as c array
+void printTable(char *name, int size, WORD *tab) {
+	printf("const WORD %s[%s] = {", name, (size == BUILTIN_SLOTS) ? "BUILTIN_SLOTS" : "BUILTIN_BUCKETS");
+	for ( int i = 0; i < size; i++ ) printf("%s%5i,", (i % 16) ? "" : "\n\t", tab[i]);
+	printf("\n};\n");
+	return;
+}
+
+/***************************************************************************
+ * main function
+ ***************************************************************************/
+ 
+int main(void) {
+	WORD seed[BUILTIN_BUCKETS] = { 0 };
+	WORD slot[BUILTIN_SLOTS]   = { 0 };
+	int  bucket[ENTRIES], size[BUILTIN_BUCKETS] = { 0 }, order[BUILTIN_BUCKETS];
+	
+	for ( int i = 0; i < ENTRIES; i++ ) {
+		const smsBuiltin *b = &builtin[i];
+		bucket[i] = builtin_hash(0, b->type, b->name, strlen(b->name)) % BUILTIN_BUCKETS;
+		size[bucket[i]]++;
+	}
+	// place biggest buckets first
+	for ( int i = 0; i < BUILTIN_BUCKETS; i++ ) order[i] = i;
+	for ( int i = 0; i < BUILTIN_BUCKETS; i++ )
+		for ( int j = i + 1; j < BUILTIN_BUCKETS; j++ )
+			if ( size[order[j]] > size[order[i]] ) { int t = order[i]; order[i] = order[j]; order[j] = t; }
+
+	for ( int o = 0; o < BUILTIN_BUCKETS; o++ ) {
+		int bkt = order[o];
+		if ( !size[bkt] ) break;
+		int s;
+		for ( s = 1; s < 0xFFFF; s++ ) {
+			int ok = TRUE;
+			for ( int i = 0; i < ENTRIES && ok; i++ ) {		// all slots of bucket free
+				if ( bucket[i] != bkt ) continue;
+				const smsBuiltin *b = &builtin[i];
+				int x = builtin_hash(s, b->type, b->name, strlen(b->name)) % BUILTIN_SLOTS;
+				if ( slot[x] ) ok = FALSE;
+				else slot[x] = i + 1;
+			}
+			if ( ok ) break;
+			for ( int x = 0; x < BUILTIN_SLOTS; x++ )		// undo partial placement
+				if ( slot[x] && bucket[slot[x]-1] == bkt ) slot[x] = 0;
+		}
+		if ( s == 0xFFFF ) {
+			printf("no seed for bucket %i, increase BUILTIN_SLOTS\n", bkt);
+			return -1;
+		}
+		seed[bkt] = s;
+	}
+	printf("// generated by mkbuiltin.c (%i names)\n", ENTRIES);
+	printTable("builtinSeed", BUILTIN_BUCKETS, seed);
+	printTable("builtinSlot", BUILTIN_SLOTS, slot);
+	return 0;
+}
@@ -11,38 +11,1034 @@
 // 
 // description of sms commands see manual.sms
 
-#include <windows.h>
 #include <stdio.h> 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <signal.h>
 
 #include "sms2mid.h"		// midi and sms api for simple music script language
 
-/***********************************************************name************
+#ifdef _WIN32
+#include <process.h>			// _getpid
+#define getpid		_getpid
+#ifndef PATH_MAX
+#define PATH_MAX	MAX_PATH
+#endif
+#else
+#include <poll.h>
+#include <sys/inotify.h>		// live coding: file watching
+#include <dirent.h>				// batch compiling: input directories
+#endif
+
+/***************************************************************************
+ * inspect midi file (-i)
+ ***************************************************************************/
+
+typedef struct TEMPO_ENTRY {
+	DWORD	time;				// absolute time in ticks
+	DWORD	usec;				// microseconds per quarter note
+	int		idx;				// order in file (same time)
+}tempoEntry;
+
+int tempo_order(const void *a, const void *b) {
+	const tempoEntry *x = a, *y = b;
+	if ( x->time != y->time ) return ( x->time < y->time ) ? -1 : 1;
+	return x->idx - y->idx;
+}
+
+// print events per track, duration and tempo map of midi file, returns FALSE if invalid
+// (big files are mapped, they must not be truncated while inspected)
+int inspect(char *fileName) {
+	smsFile *file = get_file_to_mem(fileName);
+	if (!file) {
+		printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], fileName);
+		return FALSE;
+	}
+	struct SMF  smf;
+	struct MEVT evt;
+	if (!openSMF(&smf, file->data, file->len)) {
+		printf("'%s' %s\n", fileName, ERRMSG[ERR_MIDI_FILE]);
+		clear_mem(file);
+		return FALSE;
+	}
+	printf("'%s' format %i tracks %i ppqn %i\n", fileName, smf.hdr.fmt, smf.hdr.trks, smf.hdr.ppqn);
+	
+	tempoEntry *tempo = NULL;
+	int   tempos = 0, tempoMax = 0, valid = TRUE;
+	DWORD end    = 0;									// end of song in ticks
+	while (nextTRK(&smf, &evt)) {
+		int  chn = 0, mta = 0, syx = 0;
+		char name[32] = "";
+		while (readEVT(&evt)) {
+			if (evt.status < 0xF0) { chn++; continue; }
+			if (evt.status != 0xFF) { syx++; continue; }
+			DWORD len;
+			char *data = dataMTA(&evt, &len);
+			BYTE  type = evt.data[0];
+			mta++;
+			if (type == 0x51 && len == 3) {			// tempo
+				if (tempos == tempoMax) {
+					tempoMax = (tempoMax) ? tempoMax * 2 : 64;
+					tempo    = (tempoEntry*)realloc(tempo, tempoMax * sizeof(tempoEntry));
+				}
+				tempo[tempos] = (tempoEntry){ evt.trk.time, readVAL(data, 3), tempos };
+				tempos++;
+			}
+			if ((type == 0x03 || type == 0x09) && !name[0]) {	// track or device name
+				int n = (len < sizeof(name)) ? len : sizeof(name) - 1;
+				memcpy(name, data, n);
+				name[n] = 0;
+			}
+		}
+		printf("  track %3i events %7i (channel %i meta %i sysex %i) ticks %u '%s'%s\n", 
+			evt.idx, chn + mta + syx, chn, mta, syx, evt.trk.time, name, 
+			(evt.err) ? " invalid event data" : "");
+		if (evt.err) valid = FALSE;
+		if (evt.trk.time > end) end = evt.trk.time;
+		release_mem(file, smf.ptr - file->data);			// track done
+	}
+	if (smf.err || smf.trk != smf.hdr.trks) {
+		printf("  %s (%i of %i tracks)\n", ERRMSG[ERR_MIDI_FILE], smf.trk, smf.hdr.trks);
+		valid = FALSE;
+	}
+	
+	// duration with tempo map (default 120 bpm), smpte time division without tempo
+	double sec = 0;
+	if (smf.hdr.ppqn & 0x8000) {
+		int fps = 256 - (smf.hdr.ppqn >> 8), tpf = smf.hdr.ppqn & 0xFF;
+		sec = (fps && tpf) ? (double)end / (fps * tpf) : 0;
+	} else if (smf.hdr.ppqn) {
+		DWORD time = 0, usec = 500000;
+		if (tempos) qsort(tempo, tempos, sizeof(tempoEntry), tempo_order);
+		for (int i = 0; i < tempos && tempo[i].time <= end; i++) {
+			sec += (double)(tempo[i].time - time) * usec / (1000000.0 * smf.hdr.ppqn);
+			time = tempo[i].time;
+			usec = tempo[i].usec;
+		}
+		sec += (double)(end - time) * usec / (1000000.0 * smf.hdr.ppqn);
+	}
+	printf("  duration %.3f s ticks %u\n", sec, end);
+	printf("  tempo map");
+	for (int i = 0; i < tempos; i++) 
+		if (tempo[i].usec) printf(" %u:%.2f", tempo[i].time, 60000000.0 / tempo[i].usec);
+	printf("\n");
+	free(tempo);
+	clear_mem(file);
+	return valid;
+}
+
+/***************************************************************************
+ * semantic diff of midi files (-d)
+ ***************************************************************************/
+
+typedef struct DIFF_READER {
+	struct MEVT	evt;				// track reader (in place)
+	int			ppqn;				// ticks per quarter note of midi file
+	BYTE		ctl[16][128];		// controller value + 1 of channel (0: not set)
+	BYTE		prg[16];			// program + 1 of channel (0: not set)
+	DWORD		cnt;				// number of musical events
+	DWORD		barTime, bar;		// time and bar of last time signature
+	int			num, den;			// time signature (default 4/4)
+	char	   *txt;				// last text, marker, cue point or lyric
+	DWORD		txtLen;
+}diffReader;
+
+void diff_start(diffReader *r, int ppqn) {
+	struct MEVT evt = r->evt;
+	memset(r, 0, sizeof(diffReader));
+	r->evt  = evt;
+	r->ppqn = ppqn;
+	r->num  = r->den = 4;
+}
+
+// ticks per bar of current time signature (0: smpte time division)
+DWORD diff_barLen(diffReader *r) {
+	if (r->ppqn & 0x8000) return 0;
+	return (DWORD)r->ppqn * 4 * r->num / r->den;
+}
+
+// read next musical event, skipped: controller and program changes without new value
+// and meta events without effect on sound (text, names), except tempo, time and key signature
+int diff_next(diffReader *r) {
+	struct MEVT *e = &r->evt;
+	while (readEVT(e)) {
+		BYTE *d = (BYTE*)e->data, hi = e->status & 0xF0, chn = e->status & 0x0F;
+		if (e->status == 0xFF) {
+			DWORD len;
+			char *data = dataMTA(e, &len);
+			if (d[0] == 0x01 || (d[0] >= 0x05 && d[0] <= 0x07)) { r->txt = data; r->txtLen = len; }
+			if (d[0] == 0x58 && len >= 2 && ((BYTE*)data)[1] < 8) {		// time signature
+				DWORD barLen = diff_barLen(r);
+				if (barLen) r->bar += (e->trk.time - r->barTime) / barLen;
+				r->barTime = e->trk.time;
+				r->num = ((BYTE*)data)[0];
+				r->den = 1 << ((BYTE*)data)[1];
+				if (!r->num) r->num = 4;
+			}
+			if (d[0] != 0x51 && d[0] != 0x58 && d[0] != 0x59) continue;
+		} else if (hi == 0xB0) {
+			if (r->ctl[chn][d[0] & 0x7F] == d[1] + 1) continue;
+			r->ctl[chn][d[0] & 0x7F] = d[1] + 1;
+		} else if (hi == 0xC0) {
+			if (r->prg[chn] == d[0] + 1) continue;
+			r->prg[chn] = d[0] + 1;
+		}
+		r->cnt++;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// same musical event: note off as note on with velocity 0
+int diff_same(struct MEVT *a, struct MEVT *b) {
+	BYTE *da = (BYTE*)a->data, *db = (BYTE*)b->data;
+	int offA = (a->status & 0xF0) == 0x80 || ((a->status & 0xF0) == 0x90 && da[1] == 0);
+	int offB = (b->status & 0xF0) == 0x80 || ((b->status & 0xF0) == 0x90 && db[1] == 0);
+	if (offA || offB) return offA && offB && (a->status & 0x0F) == (b->status & 0x0F) && da[0] == db[0];
+	return a->status == b->status && a->len == b->len && memcmp(da, db, a->len) == 0;
+}
+
+// event as hex string: status and data bytes
+char *diff_print(char *str, struct MEVT *e, int valid) {
+	if (!valid) return strcpy(str, (e->err) ? "invalid event data" : "end of track");
+	int n = sprintf(str, "%02X", e->status);
+	for (int i = 0; i < e->len && i < 8; i++) n += sprintf(str + n, " %02X", (BYTE)e->data[i]);
+	if (e->len > 8) strcpy(str + n, " ...");
+	return str;
+}
+
+// compare musical events of midi files track by track (in place, bounded memory),
+// report first different event of each track, returns number of different tracks
+// (big files are mapped, they must not be truncated while compared)
+int diff(char *nameA, char *nameB) {
+	smsFile *fileA = get_file_to_mem(nameA);
+	smsFile *fileB = get_file_to_mem(nameB);
+	struct SMF smfA, smfB;
+	if (!fileA || !fileB) {
+		printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], (fileA) ? nameB : nameA);
+		clear_mem(fileA); clear_mem(fileB);
+		return EMPTY_ID;
+	}
+	int validA = openSMF(&smfA, fileA->data, fileA->len);
+	int validB = openSMF(&smfB, fileB->data, fileB->len);
+	if (!validA || !validB) {
+		printf("'%s' %s\n", (validA) ? nameB : nameA, ERRMSG[ERR_MIDI_FILE]);
+		clear_mem(fileA); clear_mem(fileB);
+		return EMPTY_ID;
+	}
+	printf("'%s' <> '%s'\n", nameA, nameB);
+	if (smfA.hdr.fmt != smfB.hdr.fmt || smfA.hdr.trks != smfB.hdr.trks || smfA.hdr.ppqn != smfB.hdr.ppqn)
+		printf("  format %i <> %i tracks %i <> %i ppqn %i <> %i\n", smfA.hdr.fmt, smfB.hdr.fmt, 
+			smfA.hdr.trks, smfB.hdr.trks, smfA.hdr.ppqn, smfB.hdr.ppqn);
+	
+	// ticks of both files compared with same time base
+	unsigned long long scaleA = (smfB.hdr.ppqn) ? smfB.hdr.ppqn : 1;
+	unsigned long long scaleB = (smfA.hdr.ppqn) ? smfA.hdr.ppqn : 1;
+	diffReader *ra = (diffReader*)calloc(1, sizeof(diffReader));
+	diffReader *rb = (diffReader*)calloc(1, sizeof(diffReader));
+	char strA[64], strB[64];
+	int  trks = 0, diffs = 0;
+	for (;; trks++) {
+		int hasA = nextTRK(&smfA, &ra->evt);
+		int hasB = nextTRK(&smfB, &rb->evt);
+		if (!hasA && !hasB) break;
+		if (!hasA || !hasB) {
+			printf("  track %3i only in '%s'\n", trks, (hasA) ? nameA : nameB);
+			diffs++;
+			continue;
+		}
+		diff_start(ra, smfA.hdr.ppqn);
+		diff_start(rb, smfB.hdr.ppqn);
+		struct MEVT *a = &ra->evt, *b = &rb->evt;
+		int same = TRUE;
+		while (same) {
+			int nextA = diff_next(ra), nextB = diff_next(rb);
+			if (!nextA && !nextB && !a->err && !b->err) break;
+			if (nextA && nextB && a->trk.time * scaleA == b->trk.time * scaleB && diff_same(a, b)) continue;
+			same = FALSE;
+			printf("  track %3i differs at tick %u", trks, a->trk.time);
+			if (a->trk.time != b->trk.time) printf(" <> %u", b->trk.time);
+			DWORD barLen = diff_barLen(ra);
+			if (barLen >= (DWORD)ra->num) {
+				DWORD t = a->trk.time - ra->barTime;
+				printf(" (bar %u beat %u)", ra->bar + t / barLen + 1, (t % barLen) / (barLen / ra->num) + 1);
+			}
+			printf(" event %u: %s <> %s", ra->cnt, diff_print(strA, a, nextA), diff_print(strB, b, nextB));
+			if (ra->txt) printf(" near '%.*s'", (int)((ra->txtLen < 32) ? ra->txtLen : 32), ra->txt);
+			printf("\n");
+		}
+		if (same && a->trk.time * scaleA != b->trk.time * scaleB) {
+			printf("  track %3i length %u <> %u ticks\n", trks, a->trk.time, b->trk.time);
+			same = FALSE;
+		}
+		if (!same) diffs++;
+		release_mem(fileA, smfA.ptr - fileA->data);			// tracks done
+		release_mem(fileB, smfB.ptr - fileB->data);
+	}
+	if (smfA.err || smfB.err) {
+		printf("  '%s' %s\n", (smfA.err) ? nameA : nameB, ERRMSG[ERR_MIDI_FILE]);
+		if (!diffs) diffs++;
+	}
+	printf("  %s: %i of %i tracks differ\n", (diffs) ? "different" : "same", diffs, trks);
+	free(ra);
+	free(rb);
+	clear_mem(fileA);
+	clear_mem(fileB);
+	return diffs;
+}
+
+/***************************************************************************
+ * play midi file or sms file (-p)
+ ***************************************************************************/
+
+// sink without device: midi messages are counted (in-process callback)
+void sink_count(void *arg, BYTE status, const char *data, int len) {
+	(void)status; (void)data; (void)len;						// message is not used
+	(*(int*)arg)++;
+}
+
+// sink of device (raw midi byte stream to file, fifo or midi device), without device 
+// the messages are only counted, fd: file descriptor of device or -1, returns FALSE on error
+int sink_open(char *device, smsSink *sink, int *cnt, int *fd) {
+	*fd   = -1;
+	*sink = (smsSink){ sink_count, cnt };
+	if (!device) return TRUE;
+	*fd = open(device, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);	// fifo: waits for reader
+	if (*fd < 0) {
+		printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], device);
+		return FALSE;
+	}
+	*sink = (smsSink){ sink_write, (void*)(intptr_t)*fd };
+	return TRUE;
+}
+
+// print number of played messages, playing time and jitter
+void play_report(smsPlayStat *stat, long long start) {
+	printf("played %i midi messages in %.3f s, real-time priority %s\n", stat->cnt, 
+		(clock_usec() - start) / 1000000.0, (stat->realtime) ? "yes" : "no");
+	printf("jitter usec p50 %lli p90 %lli p99 %lli p99.9 %lli max %lli\n", 
+		jitter_percentile(stat, 50), jitter_percentile(stat, 90), jitter_percentile(stat, 99),
+		jitter_percentile(stat, 99.9), stat->max);
+}
+
+// play midi file or compiled sms file in real time to device, report jitter of playback, 
+// returns FALSE on error
+int play(smsCtx *ctx, char *fileName, char *device) {
+	smsFile *file = get_file_to_mem(fileName);
+	if (!file) {
+		printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], fileName);
+		return FALSE;
+	}
+	struct SMF  smf;
+	struct BUF *mid  = NULL;
+	char       *data = file->data;
+	int         len  = file->len;
+	if (!openSMF(&smf, data, len)) {							// sms script: compile it
+		char *msg;
+		mid = sms2midi(ctx, file->data, file->len, &msg);
+		printf("%s\n", msg);
+		free(msg);
+		if (!mid) {
+			clear_mem(file);
+			return FALSE;
+		}
+		data = mid->mem;
+		len  = mid->cnt;
+	}
+	int        cnt = 0, fd;
+	smsSink    sink;
+	smsPlayer *pl  = NULL;
+	if (sink_open(device, &sink, &cnt, &fd)) {
+		pl = play_open(sink);
+		if (!pl) printf("playback thread not started\n");
+	}
+	if (pl) {
+		long long   start = clock_usec();
+		smsPlayStat stat;
+		play_song(pl, data, len, 0);
+		play_close(pl, &stat);
+		play_report(&stat, start);
+	}
+	if (fd >= 0) close(fd);
+	freeBUF(mid);
+	clear_mem(file);
+	return (pl != NULL);
+}
+
+/***************************************************************************
+ * live coding: play sms file in a loop, recompile on change (-w)
+ ***************************************************************************/
+
+typedef struct SMS_WATCH {
+	char	   *name;				// file name (without directory)
+	int			fd;					// inotify descriptor, watches directory of file
+	time_t		mtime;				// windows: last modification time (polling)
+	char	   *path;				// file name with directory
+}smsWatch;
+
+volatile sig_atomic_t liveStop = FALSE;	// TRUE: stop live playback (ctrl-c)
+
+void live_stop(int sig) {
+	(void)sig;												// only SIGINT is handled
+	liveStop = TRUE;
+}
+
+// watch file for changes, the directory is watched as editors replace files by renaming,
+// returns FALSE if not possible
+int watch_open(smsWatch *w, char *fileName) {
+	char *sep = strrchr(fileName, '/');
+#ifdef _WIN32
+	char *bsl = strrchr(fileName, '\\');
+	if (bsl > sep) sep = bsl;
+#endif
+	w->path = fileName;
+	w->name = (sep) ? sep + 1 : fileName;
+#ifdef _WIN32
+	struct stat st;
+	w->fd    = -1;
+	w->mtime = (stat(fileName, &st) == 0) ? st.st_mtime : 0;
+	return TRUE;
+#else
+	char dir[PATH_MAX] = ".";
+	if (sep && sep - fileName < PATH_MAX) {
+		memcpy(dir, fileName, sep - fileName);
+		dir[(sep == fileName) ? 1 : sep - fileName] = '\0';
+	}
+	w->fd = inotify_init();
+	if (w->fd < 0) return FALSE;
+	if (inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(w->fd);
+		return FALSE;
+	}
+	return TRUE;
+#endif
+}
+
+// wait at most usec for a change of file, returns TRUE if file is changed
+int watch_wait(smsWatch *w, long long usec) {
+	int changed = FALSE;
+#ifdef _WIN32
+	struct stat st;
+	Sleep((DWORD)((usec < 10000) ? usec / 1000 : 10));			// polling every 10 ms
+	if (stat(w->path, &st) == 0 && st.st_mtime != w->mtime) {
+		w->mtime = st.st_mtime;
+		changed  = TRUE;
+	}
+#else
+	struct pollfd pfd = { w->fd, POLLIN, 0 };
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	if (poll(&pfd, 1, (int)(usec / 1000)) <= 0) return FALSE;
+	int n = read(w->fd, buf, sizeof(buf));
+	for (char *p = buf; p < buf + n; ) {
+		struct inotify_event *evt = (struct inotify_event*)p;
+		if (evt->len && strcmp(evt->name, w->name) == 0) changed = TRUE;
+		p += sizeof(struct inotify_event) + evt->len;
+	}
+#endif
+	return changed;
+}
+
+void watch_close(smsWatch *w) {
+	if (w->fd >= 0) close(w->fd);
+}
+
+// compile sms file again after change to SMF buffer (from line before first change),
+// bar: bar length in ticks, from: line of continuing, NULL on error (message printed)
+struct BUF *live_compile(smsCtx *ctx, char *fileName, int *bar, int *from) {
+	smsFile *file = get_file_to_buf(fileName);					// editor may rewrite file in place
+	if (!file) {
+		printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], fileName);
+		return NULL;
+	}
+	char       *msg;
+	struct BUF *mid = sms2midiEdit(ctx, file->data, file->len, &msg, bar, from);
+	if (!mid) printf("%s\n", msg);
+	free(msg);
+	clear_mem(file);
+	if (mid && *bar <= 0) *bar = DEFAULT_PPQN * 4;
+	return mid;
+}
+
+// play sms file in a loop, on change it is compiled again and the new song is played 
+// from the next bar boundary (same position in song, settings of channels are chased),
+// the song in playback is kept on compiler errors, returns FALSE on error
+int live(smsCtx *ctx, char *fileName, char *device) {
+	smsWatch watch;
+	if (!watch_open(&watch, fileName)) {
+		printf("can't watch '%s'\n", fileName);
+		return FALSE;
+	}
+	int         bar, nextBar = 0, from;
+	struct BUF *mid  = live_compile(ctx, fileName, &bar, &from);
+	struct BUF *next = NULL, *prev = NULL;					// new song, song before (sysex data)
+	int         cnt  = 0, fd = -1;
+	smsSink     sink;
+	smsPlayer  *pl   = NULL;
+	if (mid && sink_open(device, &sink, &cnt, &fd)) {
+		pl = play_open(sink);
+		if (!pl) printf("playback thread not started\n");
+	}
+	if (!pl) {
+		if (fd >= 0) close(fd);
+		freeBUF(mid);
+		sms2midiEditEnd(ctx);
+		watch_close(&watch);
+		return FALSE;
+	}
+	printf("live playback of '%s', ctrl-c stops\n", fileName);
+	signal(SIGINT, live_stop);
+	
+	smsSong     song;
+	smsChase    chase;
+	struct MEVT evt;
+	double      usec;
+	long long   start  = clock_usec(), changed = 0;
+	long long   offset = 0;										// playback time of song tick 0
+	long long   queued = 0;										// playback time of last queued event
+	DWORD       last   = 0, swap = 0;							// tick of last queued event, of swap
+	song_open(&song, mid->mem, mid->cnt);
+	while (!liveStop) {
+		long long now = clock_usec() - pl->start;				// playback time
+		// queue events of next PLAY_AHEAD microsec, events from swap tick belong to new song
+		while (song.cnt && !(next && song.heap[0]->trk.time >= swap)) {
+			if (offset + song_usec(&song, song.heap[0]->trk.time) > now + PLAY_AHEAD) break;
+			song_next(&song, &evt, &usec);
+			last = evt.trk.time;
+			if (evt.status == 0xFF || evt.status == 0xF7) continue;		// meta event, sysex escape
+			char *p = evt.data;
+			DWORD n = evt.len;
+			if (evt.status == 0xF0) readVLQ(&p, evt.end, &n);			// sysex: data after length
+			queued = offset + (long long)usec;
+			play_push(pl, queued, evt.status, p, n);
+		}
+		
+		// swap to new song at bar boundary, or next loop at end of song (new song from start)
+		int  atSwap = next && song.cnt && song.heap[0]->trk.time >= swap;
+		int  atEnd  = !song.cnt;
+		DWORD tick  = (atSwap) ? swap : (last > (DWORD)bar) ? last : (DWORD)bar;
+		long long base = offset + (long long)song_usec(&song, tick);
+		if ((atSwap || atEnd) && base <= now + PLAY_AHEAD) {
+			if (next) {
+				printf("new song at bar %u, %.1f ms after change\n", 
+					(atSwap) ? swap / bar + 1 : 1, (clock_usec() - changed) / 1000.0);
+				play_notesOff(pl, base);
+				freeBUF(prev);
+				prev = mid;
+				mid  = next;
+				bar  = nextBar;
+				next = NULL;
+			}
+			song_close(&song);
+			song_open(&song, mid->mem, mid->cnt);
+			if (atSwap) song_seek(&song, swap, &chase);
+			if (atSwap) play_chase(pl, base, &chase);
+			if (base > queued) queued = base;
+			if (!song.cnt && !atSwap) break;						// song without events
+			tick   = (atSwap) ? swap : 0;
+			offset = base - (long long)song_usec(&song, tick);
+			last   = tick;
+			continue;
+		}
+		
+		// wait for change of file until events are due
+		long long due = ((atSwap || atEnd) ? base : 
+						 offset + (long long)song_usec(&song, song.heap[0]->trk.time)) - PLAY_AHEAD - now;
+		if (!watch_wait(&watch, (due < 0) ? 0 : (due > 100000) ? 100000 : due)) continue;
+		changed = clock_usec();
+		struct BUF *mid2 = live_compile(ctx, fileName, &nextBar, &from);
+		if (!mid2) continue;										// keep playing song
+		freeBUF(next);
+		next = mid2;
+		// swap at first bar boundary after queued events
+		double pos = clock_usec() - pl->start + PLAY_AHEAD - offset;	// song time of queued events
+		double t   = (song.tempo > 0 && pos > song.usec) ? song.tick + (pos - song.usec) / song.tempo : 0;
+		swap = (t > last) ? (DWORD)t : last + 1;
+		swap = (swap + bar - 1) / bar * bar;
+		printf("compiled from line %i in %.1f ms\n", from, (clock_usec() - changed) / 1000.0);
+	}
+	long long now = clock_usec() - pl->start;
+	play_notesOff(pl, (queued > now) ? queued : now);				// after queued events
+	smsPlayStat stat;
+	play_close(pl, &stat);
+	play_report(&stat, start);
+	song_close(&song);
+	freeBUF(mid);
+	freeBUF(next);
+	freeBUF(prev);
+	sms2midiEditEnd(ctx);
+	if (fd >= 0) close(fd);
+	watch_close(&watch);
+	return TRUE;
+}
+
+/***************************************************************************
+ * midi output file
+ ***************************************************************************/
+
+// The midi file is written to a temporary file in the same directory and renamed over
+// the output file after a successful compile, so a compile error keeps the last good 
+// midi file and the input file is never truncated while it is read (same file name).
+// Existing outputs that are not regular files (fifo, device) are written directly.
+
+// open output, tmpName: temporary file (empty if written directly), -1 on error
+int out_open(const char *outName, char *tmpName) {
+	struct stat st;
+	tmpName[0] = '\0';
+	if (stat(outName, &st) == 0 && (st.st_mode & S_IFMT) != S_IFREG) 
+		return open(outName, O_WRONLY | O_BINARY);
+	for (int i = 0; i < 100; i++) {
+		snprintf(tmpName, PATH_MAX, "%s.%i.%i.tmp", outName, (int)getpid(), i);
+		int fd = open(tmpName, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+		if (fd >= 0 || errno != EEXIST) return fd;
+	}
+	return -1;
+}
+
+// close output, ok: temporary file replaces output file, else it is removed,
+// returns FALSE if not ok or output file not replaced
+int out_close(int fd, const char *outName, const char *tmpName, int ok) {
+	if (close(fd) != 0) ok = FALSE;
+	if (!tmpName[0]) return ok;
+#ifdef _WIN32
+	if (ok) ok = MoveFileExA(tmpName, outName, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	if (ok) ok = rename(tmpName, outName) == 0;
+#endif
+	if (!ok) remove(tmpName);
+	return ok;
+}
+
+/***************************************************************************
+ * batch compiling (-b)
+ ***************************************************************************/
+
+// The input files are split into one range per worker thread. A worker compiles the files
+// of its own range from the front; when it runs empty it steals the back half of the
+// biggest range left, so long scripts do not keep the other threads idle. Every worker
+// has its own compiler context (memory is reused from file to file) and its own read
+// buffer. Midi files are written with one gather write each, error reports are kept
+// per file and written at the end in order of the inputs with one write. Inputs of the
+// same midi file name (same base name, input listed twice) are reported before compiling,
+// only the first of them is compiled.
+
+typedef struct BATCH_QUEUE {
+	int			 lock;				// TRUE: range is changed (owner or thief)
+	int			 first, end;		// files of range not taken yet
+	char		 pad[52];			// own cache line of each queue
+}batchQueue;
+
+typedef struct BATCH_WORKER {
+	batchQueue	*queue;				// queues of all workers
+	int			 workers, id;		// number of workers, own queue
+	char	   **in;				// input files
+	char	   **out;				// midi file of each input file
+	char	   **report;			// error report of each input file, NULL if compiled
+	smsCtx		*ctx;				// compiler context of worker
+	char		*data;				// read buffer of scripts
+	int			 dataMax;
+	int			 errs;				// files with errors
+}batchWorker;
+
+void batch_lock(batchQueue *q) {
+	while ( !ATOMIC_CAS(&q->lock, FALSE, TRUE) ) ;				// held for a few instructions only
+}
+
+void batch_unlock(batchQueue *q) {
+	ATOMIC_SET(&q->lock, FALSE);
+}
+
+// take next file of own range, else steal back half of the biggest range of another worker,
+// returns EMPTY_ID if all files are taken
+int batch_take(batchWorker *w) {
+	batchQueue *own = &w->queue[w->id];
+	batch_lock(own);
+	int f = (own->first < own->end) ? own->first : EMPTY_ID;
+	if (f != EMPTY_ID) ATOMIC_SET(&own->first, f + 1);			// other threads peek at range
+	batch_unlock(own);
+	while (f == EMPTY_ID) {
+		int victim = EMPTY_ID, most = 0;
+		for (int i = 0; i < w->workers; i++) {
+			int left = ATOMIC_GET(&w->queue[i].end) - ATOMIC_GET(&w->queue[i].first);
+			if (i != w->id && left > most) { most = left; victim = i; }
+		}
+		if (victim == EMPTY_ID) return EMPTY_ID;
+		batchQueue *q = &w->queue[victim];
+		int first = 0, end = 0;
+		batch_lock(q);
+		if (q->first < q->end) {
+			first = q->first + (q->end - q->first) / 2;
+			end   = q->end;
+			ATOMIC_SET(&q->end, first);
+		}
+		batch_unlock(q);
+		if (first == end) continue;								// taken by owner or other thief
+		batch_lock(own);
+		ATOMIC_SET(&own->first, first + 1);
+		ATOMIC_SET(&own->end, end);
+		batch_unlock(own);
+		f = first;
+	}
+	return f;
+}
+
+// read script into read buffer of worker, returns length or -1 if not readable
+int batch_read(batchWorker *w, char *fileName) {
+	int fd = open(fileName, O_RDONLY | O_BINARY);
+	if (fd < 0) return -1;
+	int len = 0, n;
+	while (1) {
+		if (len == w->dataMax) {
+			w->dataMax = (w->dataMax) ? w->dataMax * 2 : 65536;
+			w->data    = (char*)realloc(w->data, w->dataMax);
+		}
+		n = read(fd, w->data + len, w->dataMax - len);
+		if (n <= 0) break;
+		len += n;
+	}
+	close(fd);
+	return (n < 0) ? -1 : len;
+}
+
+// midi file of same name as input file in output directory
+char *batch_outName(char *outDir, char *inName) {
+	char *base = strrchr(inName, '/');
+#ifdef _WIN32
+	char *bsl  = strrchr(inName, '\\');
+	if (bsl > base) base = bsl;
+#endif
+	base = (base) ? base + 1 : inName;
+	int   baseLen = strlen(base);
+	if (baseLen > 4 && strcmp(base + baseLen - 4, ".sms") == 0) baseLen -= 4;
+	int   len = snprintf(NULL, 0, "%s/%.*s.mid", outDir, baseLen, base);
+	char *out = (char*)malloc(len + 1);
+	snprintf(out, len + 1, "%s/%.*s.mid", outDir, baseLen, base);
+	return out;
+}
+
+// compile one input file to its midi file (written to temporary file, renamed if compiled)
+void batch_compile(batchWorker *w, int f) {
+	char *inName = w->in[f], *outName = w->out[f], tmpName[PATH_MAX], *msg = NULL;
+	int len = batch_read(w, inName);
+	int fd  = (len < 0) ? -1 : out_open(outName, tmpName);
+	if (fd < 0) {
+		w->report[f] = (char*)malloc(strlen(ERRMSG[ERR_OPEN_FILE]) + strlen(inName) + strlen(outName) + 4);
+		sprintf(w->report[f], "%s '%s'", ERRMSG[ERR_OPEN_FILE], (len < 0) ? inName : outName);
+		w->errs++;
+		return;
+	}
+	int ok      = sms2midiStream(w->ctx, w->data, len, &msg, fd);
+	int written = out_close(fd, outName, tmpName, ok);			// no incomplete midi file
+	if (ok && !written) {
+		free(msg);
+		msg = (char*)malloc(strlen(ERRMSG[ERR_WRITE_FILE]) + strlen(outName) + 4);
+		sprintf(msg, "%s '%s'", ERRMSG[ERR_WRITE_FILE], outName);
+	}
+	if (written) free(msg);
+	else {
+		w->report[f] = msg;
+		w->errs++;
+	}
+	return;
+}
+
+THREAD_RESULT batch_worker(void *arg) {
+	batchWorker *w = arg;
+	for (int f = batch_take(w); f != EMPTY_ID; f = batch_take(w)) 
+		if (!w->report[f]) batch_compile(w, f);					// else same midi file as other input
+	return 0;
+}
+
+// add input file name to list
+void batch_add(char ***in, int *cnt, int *max, const char *name, int len) {
+	if (*cnt == *max) {
+		*max = (*max) ? *max * 2 : 1024;
+		*in  = (char**)realloc(*in, *max * sizeof(char*));
+	}
+	char *s = (char*)malloc(len + 1);
+	memcpy(s, name, len);
+	s[len] = '\0';
+	(*in)[(*cnt)++] = s;
+}
+
+int batch_order(const void *a, const void *b) {
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+// compare midi file names
+int batch_nameCmp(const char *a, const char *b) {
+#ifdef _WIN32
+	return _stricmp(a, b);										// file names ignore case
+#else
+	return strcmp(a, b);
+#endif
+}
+
+// order of midi file names (pointers into list), same names in order of inputs
+int batch_outOrder(const void *a, const void *b) {
+	char **x = *(char***)a, **y = *(char***)b;
+	int    c = batch_nameCmp(*x, *y);
+	return (c) ? c : (x > y) - (x < y);
+}
+
+// report inputs of the same midi file as an earlier input, returns number of them
+int batch_same(char **in, char **out, char **report, int cnt) {
+	char ***order = (char***)malloc(cnt * sizeof(char**));
+	int     same  = 0;
+	for (int f = 0; f < cnt; f++) order[f] = &out[f];
+	qsort(order, cnt, sizeof(char**), batch_outOrder);
+	for (int i = 1, first = 0; i < cnt; i++) {
+		if (batch_nameCmp(*order[first], *order[i]) != 0) { first = i; continue; }
+		int f = order[i] - out, g = order[first] - out;
+		report[f] = (char*)malloc(strlen(ERRMSG[ERR_WRITE_FILE]) + strlen(out[f]) + strlen(in[g]) + 32);
+		sprintf(report[f], "%s '%s' (midi file of '%s')", ERRMSG[ERR_WRITE_FILE], out[f], in[g]);
+		same++;
+	}
+	free(order);
+	return same;
+}
+
+// add .sms files of directory (sorted by name), returns FALSE if not a directory
+int batch_dir(char ***in, int *cnt, int *max, char *dir) {
+	char path[PATH_MAX];
+	int  from = *cnt;
+#ifdef _WIN32
+	WIN32_FIND_DATAA fd;
+	snprintf(path, PATH_MAX, "%s\\*.sms", dir);
+	HANDLE h = FindFirstFileA(path, &fd);
+	if (h == INVALID_HANDLE_VALUE) return FALSE;
+	do {
+		int n = snprintf(path, PATH_MAX, "%s\\%s", dir, fd.cFileName);
+		if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) batch_add(in, cnt, max, path, n);
+	} while (FindNextFileA(h, &fd));
+	FindClose(h);
+#else
+	DIR *d = opendir(dir);
+	if (!d) return FALSE;
+	struct dirent *e;
+	while ((e = readdir(d))) {
+		int len = strlen(e->d_name);
+		if (len <= 4 || strcmp(e->d_name + len - 4, ".sms") != 0) continue;
+		int n = snprintf(path, PATH_MAX, "%s/%s", dir, e->d_name);
+		if (n < PATH_MAX) batch_add(in, cnt, max, path, n);
+	}
+	closedir(d);
+#endif
+	qsort(*in + from, *cnt - from, sizeof(char*), batch_order);
+	return TRUE;
+}
+
+// compile inputs (.sms files, directories of .sms files, @list: file with one input per line)
+// to midi files in output directory with one worker thread per processor,
+// returns number of files with errors or -1 if no input
+int batch(smsCtx *ctx, char *outDir, char **arg, int args, char *cacheDir) {
+	char **in = NULL;
+	int    cnt = 0, max = 0;
+	for (int a = 0; a < args; a++) {
+		if (arg[a][0] == '@') {										// list file
+			smsFile *list = get_file_to_mem(arg[a] + 1);
+			if (!list) { printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], arg[a] + 1); continue; }
+			for (int i = 0; i < list->len; ) {
+				int e = i;
+				while (e < list->len && list->data[e] != '\n') e++;
+				int n = e;
+				while (n > i && (list->data[n - 1] == '\r' || list->data[n - 1] == ' ')) n--;
+				if (n > i) batch_add(&in, &cnt, &max, list->data + i, n - i);
+				i = e + 1;
+			}
+			clear_mem(list);
+		} else if (!batch_dir(&in, &cnt, &max, arg[a])) {
+			batch_add(&in, &cnt, &max, arg[a], strlen(arg[a]));
+		}
+	}
+	if (!cnt) {
+		printf("no input files\n");
+		return -1;
+	}
+#ifdef _WIN32
+	CreateDirectoryA(outDir, NULL);
+#else
+	mkdir(outDir, 0755);
+#endif
+	
+	long long start = clock_usec();
+	int threads = thread_cpus();
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	if (threads > cnt)         threads = cnt;
+	batchQueue  queue[MAX_THREADS];
+	batchWorker worker[MAX_THREADS];
+	smsThread   thread[MAX_THREADS];
+	int         started[MAX_THREADS] = { 0 };
+	char      **mid    = (char**)malloc(cnt * sizeof(char*));
+	char      **report = (char**)calloc(cnt, sizeof(char*));
+	for (int f = 0; f < cnt; f++) mid[f] = batch_outName(outDir, in[f]);
+	int         errs   = batch_same(in, mid, report, cnt);		// not compiled
+	for (int w = 0; w < threads; w++) {
+		queue[w]  = (batchQueue){ FALSE, (int)((long long)cnt * w / threads), 
+								  (int)((long long)cnt * (w + 1) / threads), { 0 } };
+		worker[w] = (batchWorker){ queue, threads, w, in, mid, report, newSmsCtx(NULL), NULL, 0, 0 };
+		worker[w].ctx->compact = ctx->compact;
+		worker[w].ctx->format0 = ctx->format0;
+		worker[w].ctx->threads = 1;								// files are compiled in parallel
+		if (cacheDir) cache_open(worker[w].ctx, cacheDir);
+	}
+	for (int w = 1; w < threads; w++) started[w] = thread_start(&thread[w], batch_worker, &worker[w]);
+	batch_worker(&worker[0]);									// calling thread is worker 0
+	for (int w = 1; w < threads; w++) if (started[w]) thread_join(thread[w]);
+	
+	// error reports in order of inputs, one write
+	int size = 0;
+	for (int f = 0; f < cnt; f++) if (report[f]) size += strlen(in[f]) + strlen(report[f]) + 8;
+	char *out = (char*)malloc(size + 1), *p = out;
+	for (int f = 0; f < cnt; f++) if (report[f]) {
+		int n = strlen(report[f]);
+		if (n && report[f][n - 1] == '\n') report[f][n - 1] = '\0';
+		p += sprintf(p, "'%s'\n%s\n\n", in[f], report[f]);
+		free(report[f]);
+	}
+	fwrite(out, 1, p - out, stdout);
+	free(out);
+	for (int w = 0; w < threads; w++) {
+		errs += worker[w].errs;
+		freeSmsCtx(worker[w].ctx);
+		free(worker[w].data);
+	}
+	printf("batch: %i files, %i midi files, %i errors, %i threads, %.1f ms\n", 
+		cnt, cnt - errs, errs, threads, (clock_usec() - start) / 1000.0);
+	for (int f = 0; f < cnt; f++) { free(in[f]); free(mid[f]); }
+	free(in);
+	free(mid);
+	free(report);
+	return errs;
+}
+
+/***************************************************************************
  * main function
  ***************************************************************************/
  
 int main(int argc, char **argv) {
 	int midiSMS = TRUE;
+	smsCtx *ctx = newSmsCtx(NULL);								// compiler context
 	
-	printf("sms2midi with included sms version %s (c) ma.ke.\n", SMSVERSION);
+	// options
+	int arg = 1, midiInspect = FALSE, midiDiff = FALSE, midiPlay = FALSE, midiLive = FALSE;
+	char *cacheDir = NULL, *batchDir = NULL;
+	while (arg < argc && argv[arg][0] == '-' && argv[arg][1]) {
+		if (strcmp(argv[arg], "-c") == 0) ctx->compact = TRUE;	// size optimized midi file
+		else if (strcmp(argv[arg], "-0") == 0) ctx->format0 = TRUE;	// midi file type 0
+		else if (strcmp(argv[arg], "-i") == 0) midiInspect = TRUE;	// inspect midi files
+		else if (strcmp(argv[arg], "-d") == 0) midiDiff = TRUE;		// compare midi files
+		else if (strcmp(argv[arg], "-p") == 0) midiPlay = TRUE;		// play midi or sms file
+		else if (strcmp(argv[arg], "-w") == 0) midiLive = TRUE;		// live coding, watch sms file
+		else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) batchDir = argv[++arg];	// batch compiling
+		else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc) cacheDir = argv[++arg];	// compile cache
+		else if (strcmp(argv[arg], "--cache-stats") == 0) ctx->cache.stats = TRUE;	// report of compile cache
+		else argc = 0;											// unknown option
+		arg++;
+	}
+	
+	if (ctx->cache.stats && !cacheDir) cacheDir = ".smscache";
+	if (cacheDir && argc && !cache_open(ctx, cacheDir)) {
+		printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], cacheDir);
+		freeSmsCtx(ctx);
+		return -2;
+	}
+	
+	if (midiInspect && argc - arg > 0) {
+		int valid = TRUE;
+		for (; arg < argc; arg++) if (!inspect(argv[arg])) valid = FALSE;
+		freeSmsCtx(ctx);
+		return (valid) ? 0 : -2;
+	}
 	
-	if (argc < 3) {
-	printf("usage: %s input.sms output.mid\n", argv[0]);
+	if (midiDiff && argc - arg == 2) {
+		int diffs = diff(argv[arg], argv[arg + 1]);
+		freeSmsCtx(ctx);
+		return (diffs < 0) ? -2 : (diffs > 0);
+	}
+	
+	if (midiPlay && (argc - arg == 1 || argc - arg == 2)) {
+		int ok = play(ctx, argv[arg], (argc - arg == 2) ? argv[arg + 1] : NULL);
+		freeSmsCtx(ctx);
+		return (ok) ? 0 : -2;
+	}
+	
+	if (midiLive && (argc - arg == 1 || argc - arg == 2)) {
+		int ok = live(ctx, argv[arg], (argc - arg == 2) ? argv[arg + 1] : NULL);
+		freeSmsCtx(ctx);
+		return (ok) ? 0 : -2;
+	}
+	
+	if (batchDir && argc - arg > 0) {
+		int errs = batch(ctx, batchDir, argv + arg, argc - arg, cacheDir);
+		freeSmsCtx(ctx);
+		return (errs) ? -2 : 0;
+	}
+	
+	if (argc - arg < 2) {
+	printf("sms2midi with included sms version %s (c) ma.ke.\n", SMSVERSION);
+	printf("usage: %s [-c] [-0] [--cache dir] [--cache-stats] input.sms output.mid\n", argv[0]);
+	printf("       %s -i input.mid ...\n", argv[0]);
+	printf("       %s -d old.mid new.mid\n", argv[0]);
+	printf("       %s -p input.sms|input.mid [device]\n", argv[0]);
+	printf("       %s -w input.sms [device]\n", argv[0]);
+	printf("       %s [-c] [-0] [--cache dir] -b outdir input.sms|dir|@list ...\n", argv[0]);
+	printf("       -c   compact midi file (running status, no redundant bank/program)\n");
+	printf("       -0   midi file type 0 (all tracks merged into one track)\n");
+	printf("       -i   inspect midi files (events per track, duration, tempo map)\n");
+	printf("       -d   compare musical events of midi files, first difference per track\n");
+	printf("       -p   play in real time to device (raw midi bytes: file, fifo, midi port), report jitter\n");
+	printf("       -w   play in a loop, on change compile again and play new song from next bar\n");
+	printf("       -b   compile many files on all processors, midi files into outdir, errors per file\n");
+	printf("            (dir: all .sms files of directory, @list: file with one input per line)\n");
+	printf("       --cache dir    keep compiled macros in directory, load them while unchanged\n");
+	printf("       --cache-stats  report hits and saved time of compile cache (default dir .smscache)\n");
+	printf("       output.mid as - writes midi file to stdout\n");
+		freeSmsCtx(ctx);
 		return -1;
 	}
 	
-	char  *msg;
-	char  *data 	= get_file_to_mem(argv[1]);
-	struct BUF *smf = sms2midi(data, &msg);
+	// messages to stderr if midi file is written to stdout
+	char *outName	= argv[arg + 1];
+	int   toStdout	= (strcmp(outName, "-") == 0);
+	FILE *con		= (toStdout) ? stderr : stdout;
+	fprintf(con, "sms2midi with included sms version %s (c) ma.ke.\n", SMSVERSION);
 	
-	if (!smf) {
-		printf("%s\n", msg);
+	char  *msg;
+	smsFile *file	= get_file_to_mem(argv[arg]);
+	if (!file) {
+		fprintf(con, "%s '%s'\n", ERRMSG[ERR_OPEN_FILE], argv[arg]);
+		freeSmsCtx(ctx);
 		return -2;
 	}
 	
-	writeSMF(argv[2], smf);
-	free(data);
-	printf("%s ready\n", msg);
-	return 0;
+	int  fd;
+	char tmpName[PATH_MAX];
+	if (toStdout) {
+		fd = fileno(stdout);
+#ifdef _WIN32
+		_setmode(fd, O_BINARY);
+#endif
+	} else {
+		fd = out_open(outName, tmpName);						// renamed after compiling
+		if (fd < 0) {
+			fprintf(con, "%s '%s'\n", ERRMSG[ERR_OPEN_FILE], outName);
+			clear_mem(file);
+			freeSmsCtx(ctx);
+			return -2;
+		}
+	}
+	
+	// midi file is written while encoding, without SMF buffer
+	int ok = sms2midiStream(ctx, file->data, file->len, &msg, fd);
+	int written = (toStdout) ? ok : out_close(fd, outName, tmpName, ok);
+	clear_mem(file);
+	freeSmsCtx(ctx);
+	fprintf(con, (ok) ? "%s ready\n" : "%s\n", msg);
+	if (ok && !written) {
+		fprintf(con, "%s '%s'\n", ERRMSG[ERR_WRITE_FILE], outName);
+		ok = FALSE;
+	}
+	free(msg);
+	return (ok) ? 0 : -2;
 }	
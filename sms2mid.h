@@ -7,6 +7,7 @@
 //
 //	features:	- create, save, midifile type 0 or 1
 //				- provide running mode only for reading midi file
+//				- read midi file in place (chunks, events, running status, meta, sysex)
 //      		- complete channel messages
 //				- meta events TXT, CPR, TRK, INS, LYR and TMP
 //				- sysex data (F0 ... data ... F7)
@@ -15,10 +16,42 @@
 //				- other meta events as described not supported
 //      		- sysex request not supported
 
+#ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+struct iovec {						// io vector for gather write
+	void		*iov_base;
+	size_t		 iov_len;
+};
+#else
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>				// writev (gather write of SMF)
+#include <pthread.h>				// link with -lpthread (worker threads)
+#include <sched.h>					// real-time priority of playback thread
+#include <time.h>					// monotonic clock and absolute sleep of playback
+typedef uint8_t		BYTE;
+typedef uint16_t	WORD;
+typedef uint32_t	DWORD;
+#define TRUE		1
+#define FALSE		0
+#endif
 #include <stdio.h> 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+#ifndef IOV_MAX
+#define IOV_MAX		16					// max. io vectors per gather write
+#endif
 
 /******************************************
  * midi API
@@ -34,12 +67,29 @@ struct BUF {
 	struct BUF 	*next; 					// link to next track (linked list)
 };
 
+struct TRKS {							// track list, empty if zero initialized
+	struct BUF	*head;					// first track (linked list)
+	int			 num;					// number of tracks in list
+	struct BUF	*spare;					// buffers of cleared tracks for reuse (linked list)
+	struct MEVT	*evt;					// merging: reader of each track
+	struct MEVT	**heap;					// merging: min heap of readers
+	BYTE		*chunk;					// streaming: chunk headers
+	struct iovec *iov;					// streaming: io vectors
+	int			 max;					// number of tracks of merging and streaming memory
+};
+
 // functions for track/memory file (incl. link list)
-struct 	BUF* newTRK();									// create new track
-void 	freeTRKs();										// clear memory of all tracks
+struct 	BUF* newTRK(struct TRKS *trks);					// create new track
+struct 	BUF* newBUF();									// create new track buffer (not linked)
+struct 	BUF* spareBUF(struct TRKS *trks);				// get buffer of cleared track or new buffer (not linked)
+void 	linkTRK(struct TRKS *trks, struct BUF *trk);	// link track buffer as new track
+void 	clearTRKs(struct TRKS *trks);					// remove all tracks, buffers are kept for reuse
+void 	freeTRKs(struct TRKS *trks);					// clear memory of all tracks
+void 	mergeTRKs(struct TRKS *trks, int running);		// merge all tracks into one track (type 0)
 
 // functions for midi file
-struct 	BUF* newSMF(int ppqn);							// create new SMF buffer
+struct 	BUF* newSMF(struct TRKS *trks, int ppqn);		// create new SMF buffer
+struct 	BUF* streamSMF(struct TRKS *trks, int fd, int ppqn);	// write SMF to file descriptor (gather write)
 int 	writeSMF(char *filename, struct BUF *smf);		// write SMF buffer to file
 void 	freeBUF(struct BUF *smf);						// clear memory
 
@@ -49,6 +99,13 @@ void 	writeSYX(struct BUF *trk, BYTE data[]);
 void 	writeTMP(struct BUF *trk, int microsec);
 void    writeMTA(struct BUF *trk, int type, BYTE data[]);
 
+// functions for placing midi data into memory of exact size (size, then put)
+int 	sizeMSG(DWORD timediv, BYTE status);
+int 	sizeMTA(const char *data);
+BYTE   *putMSG(BYTE *p, DWORD timediv, BYTE status, BYTE data1, BYTE data2);
+BYTE   *putTMP(BYTE *p, int microsec);
+BYTE   *putMTA(BYTE *p, int type, const char *data);
+
 /******************************************
  * midi internals
  ******************************************/
@@ -69,6 +126,34 @@ struct MTRK {
 	BYTE		lastStatus;	// rember last status byte
 };
 
+struct MEVT {
+	struct MTRK	trk;		// reader of track: absolute time, read pointer, running status
+	char		*end;		// end of track data
+	int			idx;		// index of track (same time: lower index first)
+	BYTE		status;		// status byte of current event
+	char		*data;		// data bytes of current event (without status byte)
+	int			len;		// number of data bytes
+	int			err;		// TRUE: invalid event data
+};
+
+struct SMF {
+	struct MTHD	hdr;		// midi header
+	char		*ptr;		// next chunk
+	char		*end;		// end of midi file data
+	int			trk;		// number of read tracks
+	int			err;		// TRUE: invalid chunk
+};
+
+// functions for placing midi data with running status (lastStatus of track)
+int 	sizeRUN(struct MTRK *trk, DWORD timediv, BYTE status);
+BYTE   *putRUN(BYTE *p, struct MTRK *trk, DWORD timediv, BYTE status, BYTE data1, BYTE data2);
+
+// functions for reading midi file data in place (e.g. mapped file), without allocation
+int 	openSMF(struct SMF *smf, char *data, int len);	// read header of midi file
+int 	nextTRK(struct SMF *smf, struct MEVT *evt);		// start reading next track
+int 	readEVT(struct MEVT *evt);						// read next event of track
+char   *dataMTA(struct MEVT *evt, DWORD *len);			// data of meta event
+
 enum MKMIDI {
 	EVT_MTHD		= 0x4D546864,		// midi header ID	: 4 byte ("MThd")
 	EVT_MTRK		= 0x4D54726B,		// track header ID	: 4 byte ("MTrk")
@@ -110,45 +195,74 @@ WORD swap16(WORD x) {
  *
  ****************************************************************************************/
  
-// initialize linklist
-struct BUF *head 	= NULL;
-struct BUF *current = NULL;
-
 // get number of tracks
-int getNumTRK() {
-	int i = 0;
-	struct BUF *trk = head;							// start from the first link
-	if(!trk) return i;							    // list is empty
-	while(trk) {									// navigate through list  	 		 					
-		i++;										// and count
-		trk = trk->next;							// go to next link
-	}
-	return i;
+int getNumTRK(struct TRKS *trks) {
+	return trks->num;
 }
 
-// create new track
-struct BUF* newTRK() {
-	if( getNumTRK() >= 0xFFFF ) return NULL;					    // more then 65535‬
+// create new track buffer, not linked (e.g. encoded by a worker thread)
+struct BUF* newBUF() {
 	struct BUF *link = (struct BUF*) malloc(sizeof(struct BUF));	// create a link
 	link->mem 	= malloc(sizeof(char) * BUFSIZE);
 	link->len 	= BUFSIZE;
 	link->cnt 	= 0;
-	link->next 	= head;								// point it to old first node
-	head = link;									// point first to new first node
+	link->next 	= NULL;
+	return link;
+}
+
+// get buffer of a cleared track (empty, memory kept) or a new buffer, not linked
+struct BUF* spareBUF(struct TRKS *trks) {
+	struct BUF *link = trks->spare;
+	if ( !link ) return newBUF();
+	trks->spare = link->next;
+	link->cnt   = 0;
+	link->next  = NULL;
+	return link;
+}
+
+// link track buffer as new track
+void linkTRK(struct TRKS *trks, struct BUF *link) {
+	link->next 	= trks->head;						// point it to old first node
+	trks->head	= link;								// point first to new first node
+	trks->num++;
+	return;
+}
+
+// create new track
+struct BUF* newTRK(struct TRKS *trks) {
+	if( getNumTRK(trks) >= 0xFFFF ) return NULL;				    // more then 65535‬
+	struct BUF *link = spareBUF(trks);
+	linkTRK(trks, link);
 	return link;
 }
 
+// remove all tracks, their buffers are kept for the next tracks
+void clearTRKs(struct TRKS *trks) {
+	while ( trks->head ) {
+		struct BUF *trk = trks->head;
+		trks->head  = trk->next;
+		trk->next   = trks->spare;
+		trks->spare = trk;
+	}
+	trks->num = 0;
+	return;
+}
+
 // clear memory for all tracks
-void freeTRKs() {
-	struct BUF *current = head;		   				// start from beginning
-	if(!current) return;							// list is empty
+void freeTRKs(struct TRKS *trks) {
+	clearTRKs(trks);
+	struct BUF *current = trks->spare;				// start from beginning
 	while(current) {								// navigate through list and
 		struct BUF *trk = current;
 		current = current->next;					// go to next link
 		free(trk->mem);								// clear current track
 		free(trk);
 	}
-	head = current = NULL;							// initialize linklist
+	free(trks->evt);
+	free(trks->heap);
+	free(trks->chunk);
+	free(trks->iov);
+	memset(trks, 0, sizeof(struct TRKS));			// initialize linklist
 	return;
 }
 
@@ -161,8 +275,8 @@ void freeTRKs() {
 // write byte to buffer
 //
 void writeBYTE(struct BUF *buf, BYTE value)	{
-	if ( buf->cnt + 1 >= buf->len ) {			// dynamic buffer size
-		buf->len += BUFSIZE;
+	if ( buf->cnt + 1 >= buf->len ) {			// dynamic buffer size, doubled
+		buf->len *= 2;
 		buf->mem = realloc(buf->mem, sizeof(BYTE) * buf->len); 
 	}
 	buf->mem[buf->cnt++] = value;
@@ -259,6 +373,223 @@ void writeTMP(struct BUF *trk, int microsec) {
 	return;
 }
 
+/****************************************************************************************
+ *
+ * c functions for placing MIDI data into memory of exact size (track encoder)
+ *
+ ***************************************************************************************/
+
+// size of variable length quantity (1 ... 4 byte)
+int sizeVLQ(DWORD value) {
+	return 1 + (value > 0x7F) + (value > 0x3FFF) + (value > 0x1FFFFF);
+}
+
+// size of MIDI event (status byte 0x8n - 0xEn + databyte1 + databyte2)
+int sizeMSG(DWORD timediv, BYTE status) {
+	int data2 = (status & 0xf0) != 0xc0 && (status & 0xf0) != 0xd0;
+	return sizeVLQ(timediv) + 2 + data2;
+}
+
+// size of META data
+int sizeMTA(const char *data) {
+	int size = strlen(data);
+	return ( size ) ? 1 + 2 + sizeVLQ(size) + size : 0;
+}
+
+// put variable length quantity
+BYTE *putVLQ(BYTE *p, DWORD value) {
+	for ( int n = sizeVLQ(value) - 1; n > 0; n-- )		// high bytes first
+		*p++ = 0x80 | ((value >> (7 * n)) & 0x7F);
+	*p++ = value & 0x7F;
+	return p;
+}
+
+// put value with number of bytes (big endian)
+BYTE *putVAL(BYTE *p, DWORD value, int bytes) {
+	while ( bytes-- ) *p++ = (value >> (bytes * 8)) & 0xFF;
+	return p;
+}
+
+// put MIDI event (status byte 0x8n - 0xEn + databyte1 + databyte2)
+BYTE *putMSG(BYTE *p, DWORD timediv, BYTE status, BYTE data1, BYTE data2) {
+	p    = ( timediv < 0x80 ) ? (*p = timediv, p + 1) : putVLQ(p, timediv);
+	p[0] = status;
+	p[1] = data1;
+	p[2] = data2;								// not used by program change and channel after touch
+	return p + 2 + ((status & 0xf0) != 0xc0 && (status & 0xf0) != 0xd0);
+}
+
+// put meta event TEMPO ( FF 51 03 tt tt tt )
+BYTE *putTMP(BYTE *p, int microsec) {
+	*p++ = 0;									// meta event always with timediv=0
+	p = putVAL(p, EVT_TMP, 3);
+	return putVAL(p, microsec, 3);
+}
+
+// put META data, last byte of byte string must be 0x00 (end of standard c string)
+BYTE *putMTA(BYTE *p, int type, const char *data) {
+	int size = strlen(data);
+	if ( !size ) return p;
+	*p++ = 0;									// meta event always with timediv=0
+	p = putVAL(p, type, 2);
+	p = putVLQ(p, size);
+	memcpy(p, data, size);
+	return p + size;
+}
+
+// size of MIDI event with running status (trk->lastStatus, 0 after meta event)
+int sizeRUN(struct MTRK *trk, DWORD timediv, BYTE status) {
+	int size = sizeMSG(timediv, status) - ( status == trk->lastStatus );
+	trk->lastStatus = status;
+	return size;
+}
+
+// put MIDI event with running status, status byte is omitted if same as last one
+BYTE *putRUN(BYTE *p, struct MTRK *trk, DWORD timediv, BYTE status, BYTE data1, BYTE data2) {
+	if ( status != trk->lastStatus ) {
+		trk->lastStatus = status;
+		return putMSG(p, timediv, status, data1, data2);
+	}
+	p    = putVLQ(p, timediv);
+	p[0] = data1;
+	p[1] = data2;								// not used by program change and channel after touch
+	return p + 1 + ((status & 0xf0) != 0xc0 && (status & 0xf0) != 0xd0);
+}
+
+/****************************************************************************************
+ *
+ * c functions for merging tracks (midi file type 0)
+ *
+ ***************************************************************************************/
+
+// read value with number of bytes (big endian)
+DWORD readVAL(char *ptr, int bytes) {
+	BYTE *p = (BYTE*)ptr;
+	DWORD value = 0;
+	while ( bytes-- ) value = (value << 8) | *p++;
+	return value;
+}
+
+// read variable length quantity (max. 4 byte), returns FALSE if not within data
+int readVLQ(char **ptr, char *end, DWORD *value) {
+	BYTE *p = (BYTE*)*ptr;
+	*value = 0;
+	for ( int i = 0; i < 4 && p < (BYTE*)end; i++ ) {
+		*value = (*value << 7) | (*p & 0x7F);
+		if ( !(*p++ & 0x80) ) { *ptr = (char*)p; return TRUE; }
+	}
+	return FALSE;
+}
+
+// read next event of track data in place, returns FALSE at end of track or invalid event (err)
+int readEVT(struct MEVT *evt) {
+	struct MTRK *trk = &evt->trk;
+	DWORD delta, len;
+	if ( trk->ptr >= evt->end ) return FALSE;
+	if ( !readVLQ(&trk->ptr, evt->end, &delta) || trk->ptr >= evt->end ) { evt->err = TRUE; return FALSE; }
+	trk->time += delta;
+	if ( *(BYTE*)trk->ptr & 0x80 ) evt->status = *(BYTE*)trk->ptr++;
+	else                           evt->status = trk->lastStatus;	// running status
+	evt->data = trk->ptr;
+	if ( evt->status == 0xFF ) {										// meta event: type len data
+		char *p = trk->ptr + 1;
+		if ( !readVLQ(&p, evt->end, &len) ) { evt->err = TRUE; return FALSE; }
+		evt->len = p - trk->ptr + len;
+		trk->lastStatus = 0;
+	} else if ( evt->status == 0xF0 || evt->status == 0xF7 ) {		// sysex: len data
+		char *p = trk->ptr;
+		if ( !readVLQ(&p, evt->end, &len) ) { evt->err = TRUE; return FALSE; }
+		evt->len = p - trk->ptr + len;
+		trk->lastStatus = 0;
+	} else if ( evt->status >= 0x80 && evt->status < 0xF0 ) {			// channel message
+		evt->len = ( (evt->status & 0xf0) == 0xc0 || (evt->status & 0xf0) == 0xd0 ) ? 1 : 2;
+		trk->lastStatus = evt->status;
+	} else { evt->err = TRUE; return FALSE; }							// no running status
+	if ( evt->len > evt->end - trk->ptr ) { evt->err = TRUE; return FALSE; }
+	trk->ptr += evt->len;
+	return TRUE;
+}
+
+// data of current meta event (without type and length), len: number of data bytes
+char *dataMTA(struct MEVT *evt, DWORD *len) {
+	char *p = evt->data + 1;
+	readVLQ(&p, evt->end, len);
+	return p;
+}
+
+// event a before event b: time, then index of track
+#define MEVT_LESS(a, b)	( (a)->trk.time < (b)->trk.time || \
+						( (a)->trk.time == (b)->trk.time && (a)->idx < (b)->idx ) )
+
+// restore min heap of events from position i downwards
+void heap_down(struct MEVT **heap, int cnt, int i) {
+	struct MEVT *evt = heap[i];
+	for ( ;; ) {
+		int c = 2 * i + 1;
+		if ( c >= cnt ) break;
+		if ( c + 1 < cnt && MEVT_LESS(heap[c + 1], heap[c]) ) c++;
+		if ( !MEVT_LESS(heap[c], evt) ) break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = evt;
+}
+
+// memory for each track of list (merging, streaming), grows with number of tracks
+void scratchTRKs(struct TRKS *trks) {
+	if ( trks->num <= trks->max ) return;
+	trks->max   = trks->num;
+	trks->evt   = (struct MEVT*)realloc(trks->evt, trks->max * sizeof(struct MEVT));
+	trks->heap  = (struct MEVT**)realloc(trks->heap, trks->max * sizeof(struct MEVT*));
+	trks->chunk = (BYTE*)realloc(trks->chunk, trks->max * 8);
+	trks->iov   = (struct iovec*)realloc(trks->iov, (1 + 3 * trks->max) * sizeof(struct iovec));
+	return;
+}
+
+// merge all tracks into one track with k-way merge of the sorted event streams,
+// delta times are recalculated, running: use running status in merged track
+void mergeTRKs(struct TRKS *trks, int running) {
+	int trkCnt = getNumTRK(trks);
+	if ( trkCnt < 2 ) return;
+	scratchTRKs(trks);
+	struct MEVT  *evt  = trks->evt;
+	struct MEVT **heap = trks->heap;
+	memset(evt, 0, trkCnt * sizeof(struct MEVT));
+	int cnt = 0, size = 0, t = 0;
+	for ( struct BUF *trk = trks->head; trk; trk = trk->next, t++ ) {
+		evt[t].trk.ptr = trk->mem;
+		evt[t].end     = trk->mem + trk->cnt;
+		evt[t].idx     = t;
+		size          += trk->cnt;
+		if ( readEVT(&evt[t]) ) heap[cnt++] = &evt[t];		// own tracks, always valid
+	}
+	for ( int i = cnt / 2 - 1; i >= 0; i-- ) heap_down(heap, cnt, i);
+
+	// events have at least 2 byte (delta, data), so at most size/2 status bytes are added
+	struct BUF *mrg = spareBUF(trks);
+	if ( mrg->len < size + size / 2 + 1 ) {
+		mrg->len = size + size / 2 + 1;
+		mrg->mem = realloc(mrg->mem, mrg->len);
+	}
+	BYTE *p = (BYTE*)mrg->mem;
+	struct MTRK out = { 0, NULL, 0 };
+	while ( cnt ) {
+		struct MEVT *e = heap[0];
+		p = putVLQ(p, e->trk.time - out.time);
+		out.time = e->trk.time;
+		if ( e->status >= 0xF0 ) 							out.lastStatus = 0;
+		if ( !running || e->status != out.lastStatus )		*p++ = e->status;
+		if ( e->status <  0xF0 ) 							out.lastStatus = e->status;
+		memcpy(p, e->data, e->len);
+		p += e->len;
+		if ( !readEVT(e) ) heap[0] = heap[--cnt];			// track finished
+		if ( cnt ) heap_down(heap, cnt, 0);
+	}
+	mrg->cnt = p - (BYTE*)mrg->mem;
+	clearTRKs(trks);
+	linkTRK(trks, mrg);
+}
+
 /****************************************************************************************
  *
  * c functions for midifile and SMF buffer
@@ -267,54 +598,149 @@ void writeTMP(struct BUF *trk, int microsec) {
  
 // read properties from midi header, fill header structure, check is valid midi file
 struct MTHD *get_MThd(struct BUF *smf) {
+	struct SMF rd;
+	if ( !smf || !openSMF(&rd, smf->mem, smf->cnt) ) return NULL;	// none midi file
 	struct MTHD *mthd = malloc(sizeof(struct MTHD));
-	if(!smf) return NULL;
-	void *ptr = smf->mem;
-	mthd->id    = swap32(*(DWORD*)ptr); ptr += sizeof(DWORD);	// id
-	if(mthd->id != EVT_MTHD) 			return NULL;			// none midi file
-	mthd->hdrl  = swap32(*(DWORD*)ptr);	ptr += sizeof(DWORD);	// header length
-	mthd->fmt   = swap16(*(WORD*)ptr); 	ptr += sizeof(WORD);	// midi format
-	mthd->trks  = swap16(*(WORD*)ptr); 	ptr += sizeof(WORD);	// number of tracks
-	mthd->ppqn  = swap16(*(WORD*)ptr); 	ptr += sizeof(WORD);	// ppqn
+	*mthd = rd.hdr;
 	return mthd;
 }
 
-// create standard SMF buffer from internal tracks (only type 0 or type 1)
-struct BUF* newSMF(int ppqn) {
-	//initialize buffer for midi file
-	struct BUF *smf = (struct BUF*) malloc(sizeof(struct BUF));
-	smf->mem = malloc(sizeof(char) * BUFSIZE);
-	smf->len = BUFSIZE;
-	smf->cnt = 0;
+// read header of midi file data in place, returns FALSE if none midi file
+int openSMF(struct SMF *smf, char *data, int len) {
+	memset(smf, 0, sizeof(struct SMF));
+	if ( len < 14 || readVAL(data, 4) != EVT_MTHD ) 		return FALSE;
+	smf->hdr.id    = EVT_MTHD;							// id
+	smf->hdr.hdrl  = readVAL(data + 4, 4);				// header length
+	if ( smf->hdr.hdrl < 6 || smf->hdr.hdrl > (DWORD)len - 8 ) return FALSE;
+	smf->hdr.fmt   = readVAL(data +  8, 2);				// midi format
+	smf->hdr.trks  = readVAL(data + 10, 2);				// number of tracks
+	smf->hdr.ppqn  = readVAL(data + 12, 2);				// ppqn
+	smf->ptr = data + 8 + smf->hdr.hdrl;
+	smf->end = data + len;
+	return TRUE;
+}
+
+// start reading next track chunk, other chunks are skipped,
+// returns FALSE if no more tracks or chunk exceeds midi file (err)
+int nextTRK(struct SMF *smf, struct MEVT *evt) {
+	while ( smf->end - smf->ptr >= 8 ) {
+		DWORD id   = readVAL(smf->ptr,     4);			// chunk id
+		DWORD len  = readVAL(smf->ptr + 4, 4);			// chunk length
+		char *data = smf->ptr + 8;
+		if ( len > (DWORD)(smf->end - data) ) { smf->err = TRUE; return FALSE; }
+		smf->ptr = data + len;
+		if ( id != EVT_MTRK ) continue;
+		memset(evt, 0, sizeof(struct MEVT));
+		evt->trk.ptr = data;
+		evt->end     = data + len;
+		evt->idx     = smf->trk++;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+// create standard SMF buffer from tracks of list (only type 0 or type 1)
+struct BUF* newSMF(struct TRKS *trks, int ppqn) {
 	// MIDI FILE HEADER create
 	int fmt = 0;
-	int trkCnt = getNumTRK();	
+	int trkCnt = getNumTRK(trks);	
 	if (trkCnt < 1) return NULL;				// no track data
 	if (trkCnt > 1) fmt = 1;					// if more than one track file type = 1
-	writeVAL(smf, swap32(EVT_MTHD), 4);			// ID,			  4 byte ("MThd")
-	writeVAL(smf, swap32(6), 4);				// HEADER LENGTH, 4 byte 
-	writeVAL(smf, swap32(fmt), 2);				// FORMAT,		  2 byte (midi file type = 0, 1, or 2)
-	writeVAL(smf, swap32(trkCnt), 2);			// TRACK COUNTER  2 byte (number of tracks = 1 - 65535)
-	writeVAL(smf, swap32(ppqn), 2); 			// DIVISION,	  2 byte (ticks per quarter-note)
+	//initialize buffer for midi file of exact size
+	int size = 14;
+	for ( struct BUF *trk = trks->head; trk; trk = trk->next ) size += 8 + trk->cnt + 4;
+	struct BUF *smf = (struct BUF*) malloc(sizeof(struct BUF));
+	smf->mem = malloc(sizeof(char) * size);
+	smf->len = size;
+	smf->cnt = size;
+	BYTE *p  = (BYTE*)smf->mem;
+	p = putVAL(p, EVT_MTHD, 4);					// ID,			  4 byte ("MThd")
+	p = putVAL(p, 6, 4);						// HEADER LENGTH, 4 byte 
+	p = putVAL(p, fmt, 2);						// FORMAT,		  2 byte (midi file type = 0, 1, or 2)
+	p = putVAL(p, trkCnt, 2);					// TRACK COUNTER  2 byte (number of tracks = 1 - 65535)
+	p = putVAL(p, ppqn, 2); 					// DIVISION,	  2 byte (ticks per quarter-note)
 	// TRACK  
-	struct BUF *trk = head;		   				// start from beginning
+	struct BUF *trk = trks->head;  				// start from beginning
 	while( trk ) {
-		writeVAL(smf, swap32(EVT_MTRK), 4);		// ID,			  4 byte ("MTrk")
-		writeVAL(smf, swap32(trk->cnt + 4), 4);	// TRACK LENGTH,  4 byte length (track size + 4 byte footer)
-		for( int i = 0; i < trk->cnt; i++)  	// TRACKDATA,     n byte track stream
-			writeBYTE(smf, trk->mem[i]);
-		writeVLQ(smf, 0);						// meta event always with timediv=0	
-		writeVAL(smf, swap32(EVT_EOT), 3);		// end of track,  3 byte	
+		p = putVAL(p, EVT_MTRK, 4);				// ID,			  4 byte ("MTrk")
+		p = putVAL(p, trk->cnt + 4, 4);			// TRACK LENGTH,  4 byte length (track size + 4 byte footer)
+		memcpy(p, trk->mem, trk->cnt);			// TRACKDATA,     n byte track stream
+		p += trk->cnt;
+		*p++ = 0;								// meta event always with timediv=0	
+		p = putVAL(p, EVT_EOT, 3);				// end of track,  3 byte	
 		trk = trk->next;						// next track
 	}	
 	return smf;
 }
 
+// gather write of io vectors to file descriptor, continues after partial write (pipe, console)
+#ifdef _WIN32
+int writev(int fd, const struct iovec *iov, int cnt) {
+	int sum = 0;
+	for ( int i = 0; i < cnt; i++ ) {					// one write per io vector
+		int n = _write(fd, iov[i].iov_base, iov[i].iov_len);
+		if ( n < 0 ) return ( sum ) ? sum : -1;
+		sum += n;
+		if ( n < (int)iov[i].iov_len ) break;
+	}
+	return sum;
+}
+#endif
+int writeIOV(int fd, struct iovec *iov, int cnt) {
+	while ( cnt > 0 ) {
+		int n = writev(fd, iov, ( cnt < IOV_MAX ) ? cnt : IOV_MAX);
+		if ( n < 0 && errno == EINTR ) continue;
+		if ( n < 0 ) return FALSE;
+		while ( cnt > 0 && n >= (int)iov->iov_len ) { n -= iov->iov_len; iov++; cnt--; }
+		if ( cnt > 0 ) { iov->iov_base = (char*)iov->iov_base + n; iov->iov_len -= n; }
+	}
+	return TRUE;
+}
+
+// write standard SMF from tracks of list to file descriptor (only type 0 or type 1)
+// chunk header, track data and footer of each track are written without copying them 
+// into one buffer, returns buffer with MThd chunk only (NULL if no track data or write error)
+struct BUF* streamSMF(struct TRKS *trks, int fd, int ppqn) {
+	static BYTE footer[4] = { 0x00, 0xFF, 0x2F, 0x00 };	// end of track with timediv=0
+	// MIDI FILE HEADER create
+	int fmt = 0;
+	int trkCnt = getNumTRK(trks);	
+	if (trkCnt < 1) return NULL;				// no track data
+	if (trkCnt > 1) fmt = 1;					// if more than one track file type = 1
+	struct BUF *smf = (struct BUF*) malloc(sizeof(struct BUF));
+	smf->mem = malloc(sizeof(char) * 14);
+	smf->len = 14;
+	smf->cnt = 14;
+	BYTE *p  = (BYTE*)smf->mem;
+	p = putVAL(p, EVT_MTHD, 4);					// ID,			  4 byte ("MThd")
+	p = putVAL(p, 6, 4);						// HEADER LENGTH, 4 byte 
+	p = putVAL(p, fmt, 2);						// FORMAT,		  2 byte (midi file type = 0, 1, or 2)
+	p = putVAL(p, trkCnt, 2);					// TRACK COUNTER  2 byte (number of tracks = 1 - 65535)
+	p = putVAL(p, ppqn, 2); 					// DIVISION,	  2 byte (ticks per quarter-note)
+	// io vectors: header, per track chunk header, track data and footer
+	scratchTRKs(trks);
+	struct iovec *iov = trks->iov;
+	int n = 0;
+	iov[n++] = (struct iovec){ smf->mem, 14 };
+	p = trks->chunk;
+	for ( struct BUF *trk = trks->head; trk; trk = trk->next ) {
+		iov[n++] = (struct iovec){ p, 8 };
+		p = putVAL(p, EVT_MTRK, 4);				// ID,			  4 byte ("MTrk")
+		p = putVAL(p, trk->cnt + 4, 4);			// TRACK LENGTH,  4 byte length (track size + 4 byte footer)
+		iov[n++] = (struct iovec){ trk->mem, trk->cnt };
+		iov[n++] = (struct iovec){ footer, 4 };
+	}
+	int ok = writeIOV(fd, iov, n);
+	if ( !ok ) { freeBUF(smf); return NULL; }
+	return smf;
+}
+
 // write midi file from SMF buffer to file system
 int writeSMF(char *filename, struct BUF *smf) {
 	if(!smf) return FALSE;
 	struct MTHD *mthd = get_MThd(smf);	
 	if(!mthd) return FALSE;								// none valid SMF buffer
+	free(mthd);
 	FILE *fp = fopen(filename, "wb");
 	fwrite(smf->mem, smf->cnt, 1, fp);
 	fclose(fp);
@@ -349,16 +775,50 @@ void freeBUF(struct BUF *smf) {
  * sms API
  ******************************************/
  
-char 	   *get_file_to_mem(char fileName[]);
-struct BUF *sms2midi(char *data, char **msg);
+typedef struct SMS_FILE {
+	char	*data;					// script data (read only, not null terminated)
+	int		 len;					// size of script data
+	int		 mapped;				// TRUE: memory mapped file, FALSE: heap buffer
+}smsFile;
+
+typedef struct SMS_ALLOC {
+	void	*(*func)(void *arg, void *mem, size_t size);	// resize memory (mem NULL: new, size 0: free)
+	void	 *arg;											// user data of allocator
+}smsAlloc;
+
+typedef struct SMS_CTX smsCtx;		// compiler context, all state of compiling (one per thread)
+
+smsFile    *get_file_to_mem(char fileName[]);
+smsFile    *get_file_to_buf(char fileName[]);
+void		clear_mem(smsFile *file);
+void		release_mem(smsFile *file, int pos);
+smsCtx     *newSmsCtx(smsAlloc *mem);
+void        freeSmsCtx(smsCtx *ctx);
+int         cache_open(smsCtx *ctx, char *dir);
+struct BUF *sms2midi(smsCtx *ctx, char *data, int len, char **msg);
+struct BUF *sms2midiBar(smsCtx *ctx, char *data, int len, char **msg, int *bar);
+struct BUF *sms2midiEdit(smsCtx *ctx, char *data, int len, char **msg, int *bar, int *from);
+void        sms2midiEditEnd(smsCtx *ctx);
+int         sms2midiStream(smsCtx *ctx, char *data, int len, char **msg, int fd);
 
 /******************************************
  * sms internals
  ******************************************/
  
 #define BUFFER			 255
+#define MAP_MINSIZE		 65536		// smaller files are read, not mapped
+#define SYMTAB_SIZE			64		// initial size of symbol table
+#define EMPTY_ID			-1		// unknown symbol id
+#define MACRO_VARIANTS		 8		// max compiled event blocks per macro
+#define MEMO_SIZE			256		// initial size of word cache
+#define MAX_THREADS			 64		// max worker threads of midi track encoding
+#define PARALLEL_MIN	  65536		// min events of song for parallel track encoding
 
 #define MAX_MIDI_DEV_OUT    256	// max midi devices
+#define PLAY_QUEUE		   4096		// events in playback queue (power of 2)
+#define PLAY_AHEAD		  20000		// microsec events are queued before they are played
+#define PLAY_SPIN		    200		// microsec of spinning before deadline (after sleeping)
+#define PLAY_HIST		  10000		// jitter histogram, buckets of 1 microsec
 #define DEFAULT_OCTAVE		  5
 #define DEFAULT_DURATION	  4
 #define DEFAULT_VOLUME		127
@@ -366,6 +826,9 @@ struct BUF *sms2midi(char *data, char **msg);
 #define DEFAULT_BPM	 		120
 #define DEFAULT_PPQN	 	 96
 #define MIDI_TIME_DIV         1		// pulses between midi not off and on at same time div
+#define TXT_COPYRIGHT	"(c) ma.ke. 2024"			// copyright note of midi file
+#define TXT_PROGRAM		"created with HIDCAM-SMS"	// program name of midi file
+#define DURATION_MAX		 64		// shortest note 1/64
 
 // sms commands (token) 	
 enum TOKEN {	
@@ -414,7 +877,7 @@ enum STATUS {
 	EMPTY 				=	255,	// flag for empty or unused position/entry
 	UNKNOWN				=   254,	// unknown, uses at lastWordType too
 	EOD					=   253,	// end of data
-	TIME_OFF			=   252,	// flag for not set time
+	TIME_OFF		= -0x7FFFFFFF,	// flag for not set time (never a valid or relative time)
 	// process typ
 	DEFINING			=   240,	// macro / block defining
 	PASSING	            =   239,	// macro / block passing
@@ -425,6 +888,16 @@ enum STATUS {
 	NOTE_MAX_OFFSET		=    24,	// for chord or tabulature base note 0 - NOTE_MAX_OFFSET	
 };
 
+// word classes of dynamic commands, routed by first char
+enum WORD_CLASS {
+	WORD_NONE,									// no dynamic command (wrong command)
+	WORD_BPM,									// bpm=
+	WORD_BAR,									// bar=
+	WORD_MIDICC,								// @name=value
+	WORD_NOTE,									// note, drum note, tab note or base note
+	WORD_CHORD,									// key chord and arp
+};
+
 enum CHORD_PROPERTIES {
 	CHORD_KEYS			=     7,
 	CHORD_OCTAVE		=	  3,
@@ -471,6 +944,9 @@ enum ERR {
 	ERR_BASENOTE,								// 37
 	ERR_HOLD_NOT_LAST,							// 38
 	ERR_HOLDOFF_MISSING,						// 39
+	ERR_ARP_OFFSET,								// 40
+	ERR_WRITE_FILE,								// 41
+	ERR_MIDI_FILE,								// 42
 	ERR_ELEMENTS,
 };
 
@@ -479,7 +955,7 @@ const char * ERRMSG[] = {
 	"file open error",										//  1
 	"wrong command",										//  2
 	"wrong arp qualifier (+ - . / !)",						//  3
-	"nested macro not allowed",								//  4
+	"recursive macro call",									//  4
 	"octave value out of range (0-10)",						//  5
 	"wrong note qualifier symbol (# < >. / !)",				//  6
 	"empty1",												//  7
@@ -515,28 +991,70 @@ const char * ERRMSG[] = {
 	"wrong base note syntax (note[oct][#]:)",				// 37
 	"hold on isn't last qualifier in note",					// 38
 	"hold off missing",										// 39
+	"invalid arp chord note [0..6]",						// 40
+	"file write error",										// 41
+	"invalid midi file",									// 42
 };
 
 /***************************************************************************
  * sms environment and structures
  ***************************************************************************/
  
-typedef struct SMS_OBJECT { 
-	char 	*name;					// name of object
-	BYTE    type;					// type of object 		(xxx)
-	void	*obj;					// pointer to object 	(xxx)
-	struct  SMS_OBJECT *next;		// link to next object
-} smsObject;
+typedef struct SMS_SYMBOL { 
+	int		name;					// offset of interned name in name pool
+	int		len;					// length of name
+	DWORD	hash;					// hash value of name
+	BYTE    type;					// type of object 		(INST, DRUM, CHORD, ARP, MACRO)
+	void	*obj;					// pointer to object 	
+} smsSymbol;
+
+typedef struct SMS_SYMTAB {
+	smsSymbol	*sym;				// symbols, index is the symbol id
+	int			 cnt;				// number of symbols
+	int			 max;				// allocated symbols
+	int			*slot;				// open addressing hash table (symbol id + 1, 0 = free)
+	int			 size;				// size of hash table (power of 2)
+	char		*names;				// name pool, interned names are null terminated
+	int			 namesLen;			// used size of name pool
+	int			 namesMax;			// allocated size of name pool
+} smsSymtab;
+
+typedef struct SMS_TOKEN {
+	const char	*ptr;				// start of word in script data (not null terminated)
+	int			 len;				// length of word
+}smsToken;
 
 typedef struct SMS_MACRO {
-	char 		*name;				// track name
+	int 		id;					// symbol id (name)
 	int  		startline;			// start line of defining
 	int         lines;				// size of macro in lines
 	int     	 cmd;               // type of user command (TKN_DEF_ARP/_VOICE/ _BLOCK)
-	char		*list;				// word list of macro
+	smsToken	*list;				// word list of macro (views into script data)
 	int			size;				// number of words
+	int			max;				// allocated words
+	struct SMS_BLOCK *blocks;		// compiled event blocks, one per entry state
+	int			variants;			// number of compiled event blocks
+	int			active;				// TRUE while passing (recursion check)
+	struct SMS_ARP_STEP *step;		// arp: compiled steps of word list
+	int			steps;				// arp: number of steps
+	int			stepPpqn;			// arp: ppqn of step durations
+	int			stepMax;			// arp: allocated steps
+	int		   *deps;				// compile cache: ids of symbols named in word list
+	int			depCnt;				// compile cache: number of ids
+	int			depMax;				// compile cache: allocated ids
+	int			depSyms;			// compile cache: number of symbols at finding ids
+	int			mark;				// compile cache: visited in key calculation
 }smsMacro;
 
+typedef struct SMS_ARP_STEP {
+	BYTE		type;				// NOTE, PAUSE, TIME_GROUP_START/_END, BARLINE or UNKNOWN (invalid word)
+	BYTE		key;				// index of chord key
+	BYTE		vol;				// volume
+	BYTE		err;				// error of invalid word
+	int			oct;				// octave
+	int			dur;				// duration in ticks
+}smsArpStep;
+
 typedef struct SMS_NOTE {
 	int 	key;					// key				[0 ... 127]
 	int 	hft;					// halftone 		[-1, 0 +1]
@@ -548,19 +1066,59 @@ typedef struct SMS_NOTE {
 }smsNote;
 
 typedef struct SMS_CHORD {
-  char  *name;						// chord name (type of chord or tab chord name)
+  int    id;						// symbol id (type of chord or tab chord name)
   BYTE  *keys;						// keys of chord
 } smsChord;
 
 typedef struct SMS_CHORD_NOTE {
 	int 		  key;				// main key			[0 ... 127]
 	int 		  hft;				// halftone 		[-1, 0 +1]
-	smsChord     *chord;			// link to chord
+	const BYTE   *chord;			// keys of chord (user or built-in chord)
 	smsMacro     *arp;				// link to arp
 }smsChordNote;
 
+typedef struct SMS_NOTE_PATCH {
+	int 	key;					// key
+	int 	hft;					// halftone
+	int    	dot;					// duration dot
+	int		oct;					// absolute octave, EMPTY if not given
+	int		octMove;				// relative octave change
+	int		octUp, octDown;			// highest change after up / lowest after down (range check)
+	int 	dur;					// duration, EMPTY if not given
+	int   	vol;					// volume,   EMPTY if not given
+	int     hold;					// TRUE if key is hold
+}smsNotePatch;
+
+typedef struct SMS_MEMO_ENTRY {
+	int				word;			// offset of word in word pool
+	int				len;			// length of word
+	DWORD			hash;			// hash value of word and parse type
+	BYTE			type;			// parse type (INST, DRUM, ARP, BASENOTE, CHORD)
+	int				err;			// result of parsing
+	int				syms;			// chord: number of symbols at parsing, later definitions invalidate entry
+	smsNotePatch	note;			// decoded note
+	smsChordNote	cnote;			// decoded chord note, hft TRUE if halftone given
+}smsMemoEntry;
+
+typedef struct SMS_MEMO {
+	smsMemoEntry	*ent;			// parsed words, index is the entry id
+	int				 cnt;			// number of entries
+	int				 max;			// allocated entries
+	int				*slot;			// open addressing hash table (entry id + 1, 0 = free)
+	int				 size;			// size of hash table (power of 2)
+	char			*words;			// word pool
+	int				 wordsLen;		// used size of word pool
+	int				 wordsMax;		// allocated size of word pool
+	int				 hits, misses;	// statistic of cache
+}smsMemo;
+
+typedef struct SMS_TICKS {
+	int		ppqn;									// ppqn of table
+	int		dur[DURATION_MAX + 1][2];				// ticks of duration without / with dot
+}smsTicks;
+
 typedef struct SMS_TRACK {
-	char    	 *name;				// name of track
+	int     	  id;				// symbol id (name of track)
 	int 		  chn;				//      channel
 	int 		  bnk;				//		bank 
 	int 		  prg;				//		program
@@ -568,13 +1126,20 @@ typedef struct SMS_TRACK {
 	smsChordNote *cnote;			// last chord note: properties
 }smsTrack;
 
+typedef struct SMS_BUILTIN {
+	const char	*name;				// built-in name
+	BYTE		 type;				// CHORD, PARAMETER (midi cc), DRUM (gm drum key), INST (gm program)
+	BYTE		 value;				// midi cc, drum key or program number
+	BYTE		 keys[CHORD_KEYS];	// keys of chord
+}smsBuiltin;
+
 typedef struct SMS_DRUMKEY {
-	char    *name;					// name of drum
+	int      id;					// symbol id (name of drum)
 	int 	 key;					// key of drum
 }smsDrumKey;
 
 typedef struct SMS_HEADER {
-	char   *name;					// name of song
+	char    name[BUFFER];			// name of song
 	int   	bpm;					// base tempo -> beat (1/4 note) per minute
 	int   	ppqn;					// pulse per quarter note (beat)
 	int  	bar;					// time signature in pulse
@@ -588,310 +1153,1291 @@ typedef struct SMS_HEADER {
 	int 	arps;					// number of arp definitions
 } smsHeader;
 
-typedef struct SMS_EVENT {
-	char 		*trkname;			// track name
-	int			evtId;				// absolute event number
-	int 		time;				// absolute time in ticks
-	BYTE		status;				// three bytes for midi message
-	BYTE		data1;				//
-	BYTE		data2;				//
-	int			bpm;				// change tempo with new bpm value
-	struct SMS_EVENT *next;			// link to next event
-}smsEvent;
-
-smsObject *objFirst, *objLast;		// object link list
-smsEvent  *evtFirst, *evtLast;		// event link list
-int		   parserPos   = 0;			// for multiple use
+typedef struct SMS_TEMPO {
+	int			evtId;				// event number of tempo change
+	int			bpm;				// new bpm value
+}smsTempo;
+
+typedef struct SMS_REF {
+	struct SMS_BLOCK *blk;			// macro event block
+	int			time;				// start time of block
+	int			evtId;				// first event number of block
+}smsRef;
+
+typedef struct SMS_EVENTS {
+	int			*time;				// absolute time in ticks
+	int			*trk;				// symbol id of track
+	int			*evtId;				// absolute event number (sequence)
+	BYTE		*status;			// three bytes for midi message, status 0 is a tempo change
+	BYTE		*data1;				//
+	BYTE		*data2;				//
+	int			 cnt, max;			// number of events
+	smsTempo	*tempo;				// tempo changes (side table)
+	int			 tempos, tempoMax;
+	smsRef		*ref;				// references to macro event blocks
+	int			 refs, refMax;
+}smsEvents;
+
+typedef struct SMS_STATE {
+	int			 bar;				// bar length in ticks
+	int			 ppqn;				// pulse per quarter note
+	int			 sngTime;			// song time in ticks
+	int			 barTime;			// bar time in ticks
+	int			 P_TIMEBLOCK;		// time block [ ] and its start / end time
+	int			 blkTimeStart, blkTimeEnd;
+	int			 P_TIMEGROUP;		// time group ( ) and its start / end / bar time
+	int			 grpTimeStart, grpTimeEnd, grpTimeBar;
+	int			 P_COMMENT;			// rest of line is comment
+	int			 currentBaseNote;	// current base note value
+	smsTrack	*currentTrk;		// current track
+	smsDrumKey	*currentDKey;		// current drum key
+}smsState;
+
+typedef struct SMS_TRACK_STATE {
+	smsTrack	*trk;				// track
+	smsNote		 note;				// last note properties
+	int			 chft;				// halftone of last chord note
+	int			 chn, bnk, prg;		// channel, bank and program
+}smsTrkState;
+
+typedef struct SMS_BLOCK {
+	int			 syms;				// number of symbols at compile time, later definitions invalidate block
+	smsState	 in;				// entry state, currentTrk / currentDKey NULL if not used
+	smsState	 out;				// exit state,  currentTrk / currentDKey NULL if not changed
+	smsTrkState	*trkIn;				// entry state of used tracks
+	smsTrkState	*trkOut;			// exit  state of used tracks
+	int			 trks, trksMax;		// number of used tracks (allocated for entry and exit)
+	smsEvents	 evt;				// events and nested blocks, time and evtId relative to block start
+	int			 size;				// number of midi events (nested blocks expanded)
+	int			 words;				// number of expanded words
+	struct SMS_BLOCK *next;			// next compiled block of macro
+	// used only while compiling
+	struct SMS_BLOCK *parent;		// enclosing block in compiling
+	smsTrack	*entryTrk;			// current track at block start
+	smsDrumKey	*entryDKey;			// current drum key at block start
+	int			 mark;				// number of events before block start
+	int			 markTempo;			// number of tempo changes before block start
+	int			 markRef;			// number of block references before block start
+	int			 start;				// song time at block start
+	int			 evtId;				// event number at block start
+	int			 cntWORD;			// word counter at block start
+	int			 cacheable;			// FALSE if block contains definitions
+	long long	 usec;				// compile cache: clock at block start, then time of compiling
+	int			 serial;			// number of block in order of compiling (edit checkpoints)
+}smsBlock;
+
+typedef struct SMS_FRAME {
+	smsMacro	*mac;				// macro in passing
+	int			 pos;				// read position in word list
+	int			 repeat;			// remaining repetitions of macro
+	smsBlock	*rec;				// nearest event block in compiling
+	int			 recOwn;			// TRUE if rec is the event block of this macro
+	int			 line, word;		// position in macro (error message)
+}smsFrame;
+
+typedef struct SMS_EDIT_TRACK {
+	smsTrack	*trk;				// track
+	smsNote		 note;				// last note properties
+	smsChordNote cnote;				// last chord note properties
+	int			 chn, bnk, prg;		// channel, bank and program
+}smsEditTrk;
+
+typedef struct SMS_CHECKPOINT {
+	int			 pos;				// read position at start of line
+	int			 line, words;		// line and word counter
+	smsState	 st;				// compiler position
+	int			 P_BLOCKCOMMENT;	// block comment open
+	smsHeader	 sms;				// header values
+	int			 syms;				// number of symbols
+	int			 evts, tempos, refs;// number of song events, tempo changes and block references
+	int			 blocks;			// number of compiled event blocks
+	int			 trk, trks;			// track states in pool
+}smsCheckpoint;
+
+typedef struct SMS_EDITS {
+	char		*data;				// script data of last compiling (own copy, macro words are views)
+	int			 len, dataMax;		// size of script data
+	int			 kept;				// TRUE: objects of last compiling are kept
+	smsCheckpoint *cp;				// compiler state at start of top level lines
+	int			 cnt, max;			// number of checkpoints
+	smsEditTrk	*trk;				// pool of track states
+	int			 trks, trksMax;		// used / allocated track states
+}smsEdits;
+
+typedef struct SMS_EVENT_KEY {
+	int			 time;				// absolute time in ticks
+	int			 evtId;				// absolute event number
+	int			 idx;				// index of event in track bucket
+}smsEvtKey;
+
+typedef struct SMS_TRACK_KEY {
+	const char	*name;				// name of track
+	int			 id;				// symbol id of track
+}smsTrkKey;
+
+typedef struct SMS_TRACK_JOB {
+	smsEvents	*list;				// events of track
+	int			 trkId;				// symbol id of track
+	int			 first;				// TRUE: first track with global midi file informations
+	int			 solo;				// TRUE: no other track on channel of track
+	struct BUF	*mtrk;				// encoded midi track
+	int			*order, *tmp, *run;	// sort buffers of event index, kept for next compiling
+	smsEvtKey	*key;				// sort keys of qsort (benchmark)
+	int			 max;				// allocated events of sort buffers
+}smsTrkJob;
+
+typedef struct SMS_WORKER {
+	smsCtx		*ctx;				// compiler context
+	smsTrkJob	*job;				// jobs of all workers
+	int			 jobs;				// number of jobs
+	int			 start, step;		// jobs of worker: start, start + step, ...
+	smsEvents	*tempo;				// tempo changes of song
+	float		 ms;				// base tempo in microsec
+}smsWorker;
+
+typedef struct SMS_LEXER {
+	const char	*data;				// script data
+	int			 len;				// size of script data
+	int			 pos;				// current read position
+}smsLexer;
+
+typedef struct SMS_CACHE {
+	char		*dir;				// cache directory, NULL: no compile cache
+	int			 stats;				// TRUE: statistic in compiler result
+	int			 hits, misses;		// loaded / not found blocks
+	int			 stores;			// stored blocks
+	long long	 saved;				// compiling time of loaded blocks in microsec
+	long long	 io;				// time of loading and storing in microsec
+	int			 mark;				// visit mark of key calculation
+	char		*buf;				// file data of variant (storing and loading)
+	int			 bufLen;
+	size_t		 bufMax;
+	smsEvents	 flat;				// events of variant (nested blocks expanded)
+}smsCache;
+
+typedef struct SMS_SPARE {
+	void		**obj;				// freed objects of one type, kept for reuse
+	int			  cnt, max;
+}smsSpare;
+
+enum SPARE_TYPE {
+	SPARE_TRK,									// smsTrack with note and chord note
+	SPARE_DKEY,									// smsDrumKey
+	SPARE_CHORD,								// smsChord with keys
+	SPARE_MACRO,								// smsMacro with word list, steps and dependencies
+	SPARE_BLOCK,								// smsBlock with track states and events
+	SPARE_TYPES,
+};
+
+// All state of compiling is kept in the context, compiles with different contexts can run 
+// at the same time. Memory of the compiler is taken from the allocator of the context and 
+// kept for the next compiling (objects, events, tables, encoding buffers), so compiling again
+// with a warm context allocates only the result (midi file and message).
+struct SMS_CTX {
+	smsAlloc	 mem;				// allocator of compiler memory
+	int			 compact;			// TRUE: size optimized midi file (running status, 
+									//		 note off as note on with velocity 0,
+									//		 without redundant bank and program)
+	int			 format0;			// TRUE: midi file type 0 (tracks merged)
+	int			 sortGeneric;		// TRUE: sort events with qsort (benchmark)
+	int			 threads;			// max threads of midi track encoding, 0: one per processor
+	smsHeader	 sms;				// header of song
+	smsSymtab	 symtab;			// symbol table of user objects
+	smsMemo		 memo;				// parsed words of notes and chords
+	smsTicks	 ticks;				// ticks of note durations
+	smsEvents	 events;			// events of song
+	int			 blockSerial;		// number of compiled event blocks
+	smsSpare	 spare[SPARE_TYPES];// freed objects for reuse
+	smsFrame	*frames;			// enclosing macros of nested macro
+	int			 framesMax;
+	smsCache	 cache;				// compile cache of macro event blocks
+	smsEdits	 edits;				// checkpoints for compiling again after an edit
+	// midi encoding
+	smsEvents	*bucket;			// events of each track
+	smsTrkJob	*job;				// encoding of each midi track
+	smsTrkKey	*trkKey;			// tracks in order of names
+	int			 trksMax;			// allocated buckets, jobs and keys
+	int			*slot;				// bucket of symbol id
+	int			 slotMax;
+	smsEvents	 tempo;				// tempo changes of song
+	struct TRKS	 trks;				// midi tracks
+};
 
 /***************************************************************************
- * sms functions
+ * sms built-in registry (chord types, midi controller, gm drum keys and programs)
  ***************************************************************************/
  
-// create sms object
-smsObject *newSmsObject(char *name, BYTE type, void *object) {
-	smsObject *obj = (smsObject*)calloc(1, sizeof(smsObject));
-		obj->name 	= (char*)malloc(strlen(name)); strcpy(obj->name, name);
-		obj->type 	= type;
-		obj->obj  	= object;
-		obj->next	= NULL;
-	if ( !objFirst ) objFirst = obj;
-	if (  objLast  ) objLast->next = obj;
-	objLast = obj;
-	return obj;
-}
-
-// get pointer for existing command (object) name
-void *getObject(char *name, int *type) {
-	smsObject *obj = objFirst;
-	while (obj) {
-		if(strcmp(obj->name, name) == 0) {
-			*type = obj->type;
-			return obj->obj;
-		}
-		obj = obj->next;
-	}
-	return NULL;
+// built-in names, user definitions of the same name overlay them
+const smsBuiltin builtin[] = {
+	// standard key chord types, major chords
+	{ "maj",    CHORD,       0, { 0, 4,   7,   EMPTY, EMPTY, EMPTY, EMPTY } },
+	{ "7",      CHORD,       0, { 0, 4,   7,    10,   EMPTY, EMPTY, EMPTY } },
+	{ "maj7",   CHORD,       0, { 0, 4,   7,    11,   EMPTY, EMPTY, EMPTY } },
+	{ "6",      CHORD,       0, { 0, 4,   7,     9,   EMPTY, EMPTY, EMPTY } },
+	{ "6/9",    CHORD,       0, { 0, 4,   7,     9,    14,   EMPTY, EMPTY } },
+	{ "5",      CHORD,       0, { 0, 7, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY } },
+	{ "9",      CHORD,       0, { 0, 4,   7,    10,    14,   EMPTY, EMPTY } },
+	{ "maj9",   CHORD,       0, { 0, 4,   7,    10,    13,   EMPTY, EMPTY } },
+	{ "11",     CHORD,       0, { 0, 4,   7,    10,    14,    16,   EMPTY } },
+	{ "13",     CHORD,       0, { 0, 4,   7,    10,    14,    17,    21   } },
+	{ "maj13",  CHORD,       0, { 0, 4,   7,    11,    14,    21,   EMPTY } },
+	{ "add",    CHORD,       0, { 0, 4,   7,    14,   EMPTY, EMPTY, EMPTY } },
+	{ "7-5",    CHORD,       0, { 0, 4,   6,    10,   EMPTY, EMPTY, EMPTY } },
+	{ "7+5",    CHORD,       0, { 0, 4,   8,    10,   EMPTY, EMPTY, EMPTY } },
+	{ "sus",    CHORD,       0, { 0, 5,   7,   EMPTY, EMPTY, EMPTY, EMPTY } },
+	{ "dim",    CHORD,       0, { 0, 3,   6,   EMPTY, EMPTY, EMPTY, EMPTY } },
+	{ "dim7",   CHORD,       0, { 0, 3,   6,     9,   EMPTY, EMPTY, EMPTY } },
+	{ "aug",    CHORD,       0, { 0, 3,   8,   EMPTY, EMPTY, EMPTY, EMPTY } },
+	{ "aug7",   CHORD,       0, { 0, 3,  10,   EMPTY, EMPTY, EMPTY, EMPTY } },
+	// minor chords
+	{ "m",      CHORD,       0, { 0, 3,   7,   EMPTY, EMPTY, EMPTY, EMPTY } },
+	{ "m7",     CHORD,       0, { 0, 3,   7,    10,   EMPTY, EMPTY, EMPTY } },
+	{ "mM7",    CHORD,       0, { 0, 3,   7,    11,   EMPTY, EMPTY, EMPTY } },
+	{ "m6",     CHORD,       0, { 0, 3,   7,     9,   EMPTY, EMPTY, EMPTY } },
+	{ "m9",     CHORD,       0, { 0, 3,   7,    10,    14,   EMPTY, EMPTY } },
+	{ "m11",    CHORD,       0, { 0, 3,   7,    10,    14,    16,   EMPTY } },
+	{ "m13",    CHORD,       0, { 0, 3,   7,    10,    14,    17,    21   } },
+	{ "m7b5",   CHORD,       0, { 0, 3,   6,    10,   EMPTY, EMPTY, EMPTY } },
+	// midi controller names
+	{ "mod",    PARAMETER,   1, { 0 } },
+	{ "vol",    PARAMETER,   7, { 0 } },
+	{ "bal",    PARAMETER,   8, { 0 } },
+	{ "pan",    PARAMETER,  10, { 0 } },
+	{ "exp",    PARAMETER,  11, { 0 } },
+	{ "sus",    PARAMETER,  64, { 0 } },
+	{ "dly",    PARAMETER,  91, { 0 } },
+	{ "cho",    PARAMETER,  93, { 0 } },
+	// general midi drum keys (channel 9)
+	{ "AcousticBassDrum",   DRUM,  35, { 0 } },
+	{ "BassDrum1",          DRUM,  36, { 0 } },
+	{ "SideStick",          DRUM,  37, { 0 } },
+	{ "AcousticSnare",      DRUM,  38, { 0 } },
+	{ "HandClap",           DRUM,  39, { 0 } },
+	{ "ElectricSnare",      DRUM,  40, { 0 } },
+	{ "LowFloorTom",        DRUM,  41, { 0 } },
+	{ "ClosedHiHat",        DRUM,  42, { 0 } },
+	{ "HighFloorTom",       DRUM,  43, { 0 } },
+	{ "PedalHiHat",         DRUM,  44, { 0 } },
+	{ "LowTom",             DRUM,  45, { 0 } },
+	{ "OpenHiHat",          DRUM,  46, { 0 } },
+	{ "LowMidTom",          DRUM,  47, { 0 } },
+	{ "HiMidTom",           DRUM,  48, { 0 } },
+	{ "CrashCymbal1",       DRUM,  49, { 0 } },
+	{ "HighTom",            DRUM,  50, { 0 } },
+	{ "RideCymbal1",        DRUM,  51, { 0 } },
+	{ "ChineseCymbal",      DRUM,  52, { 0 } },
+	{ "RideBell",           DRUM,  53, { 0 } },
+	{ "Tambourine",         DRUM,  54, { 0 } },
+	{ "SplashCymbal",       DRUM,  55, { 0 } },
+	{ "Cowbell",            DRUM,  56, { 0 } },
+	{ "CrashCymbal2",       DRUM,  57, { 0 } },
+	{ "Vibraslap",          DRUM,  58, { 0 } },
+	{ "RideCymbal2",        DRUM,  59, { 0 } },
+	{ "HiBongo",            DRUM,  60, { 0 } },
+	{ "LowBongo",           DRUM,  61, { 0 } },
+	{ "MuteHiConga",        DRUM,  62, { 0 } },
+	{ "OpenHiConga",        DRUM,  63, { 0 } },
+	{ "LowConga",           DRUM,  64, { 0 } },
+	{ "HighTimbale",        DRUM,  65, { 0 } },
+	{ "LowTimbale",         DRUM,  66, { 0 } },
+	{ "HighAgogo",          DRUM,  67, { 0 } },
+	{ "LowAgogo",           DRUM,  68, { 0 } },
+	{ "Cabasa",             DRUM,  69, { 0 } },
+	{ "Maracas",            DRUM,  70, { 0 } },
+	{ "ShortWhistle",       DRUM,  71, { 0 } },
+	{ "LongWhistle",        DRUM,  72, { 0 } },
+	{ "ShortGuiro",         DRUM,  73, { 0 } },
+	{ "LongGuiro",          DRUM,  74, { 0 } },
+	{ "Claves",             DRUM,  75, { 0 } },
+	{ "HiWoodBlock",        DRUM,  76, { 0 } },
+	{ "LowWoodBlock",       DRUM,  77, { 0 } },
+	{ "MuteCuica",          DRUM,  78, { 0 } },
+	{ "OpenCuica",          DRUM,  79, { 0 } },
+	{ "MuteTriangle",       DRUM,  80, { 0 } },
+	{ "OpenTriangle",       DRUM,  81, { 0 } },
+	// general midi programs
+	{ "AcousticGrandPiano",   INST,   0, { 0 } },
+	{ "BrightAcousticPiano",  INST,   1, { 0 } },
+	{ "ElectricGrandPiano",   INST,   2, { 0 } },
+	{ "HonkyTonkPiano",       INST,   3, { 0 } },
+	{ "ElectricPiano1",       INST,   4, { 0 } },
+	{ "ElectricPiano2",       INST,   5, { 0 } },
+	{ "Harpsichord",          INST,   6, { 0 } },
+	{ "Clavinet",             INST,   7, { 0 } },
+	{ "Celesta",              INST,   8, { 0 } },
+	{ "Glockenspiel",         INST,   9, { 0 } },
+	{ "MusicBox",             INST,  10, { 0 } },
+	{ "Vibraphone",           INST,  11, { 0 } },
+	{ "Marimba",              INST,  12, { 0 } },
+	{ "Xylophone",            INST,  13, { 0 } },
+	{ "TubularBells",         INST,  14, { 0 } },
+	{ "Dulcimer",             INST,  15, { 0 } },
+	{ "DrawbarOrgan",         INST,  16, { 0 } },
+	{ "PercussiveOrgan",      INST,  17, { 0 } },
+	{ "RockOrgan",            INST,  18, { 0 } },
+	{ "ChurchOrgan",          INST,  19, { 0 } },
+	{ "ReedOrgan",            INST,  20, { 0 } },
+	{ "Accordion",            INST,  21, { 0 } },
+	{ "Harmonica",            INST,  22, { 0 } },
+	{ "TangoAccordion",       INST,  23, { 0 } },
+	{ "AcousticGuitarNylon",  INST,  24, { 0 } },
+	{ "AcousticGuitarSteel",  INST,  25, { 0 } },
+	{ "ElectricGuitarJazz",   INST,  26, { 0 } },
+	{ "ElectricGuitarClean",  INST,  27, { 0 } },
+	{ "ElectricGuitarMuted",  INST,  28, { 0 } },
+	{ "OverdrivenGuitar",     INST,  29, { 0 } },
+	{ "DistortionGuitar",     INST,  30, { 0 } },
+	{ "GuitarHarmonics",      INST,  31, { 0 } },
+	{ "AcousticBass",         INST,  32, { 0 } },
+	{ "ElectricBassFinger",   INST,  33, { 0 } },
+	{ "ElectricBassPick",     INST,  34, { 0 } },
+	{ "FretlessBass",         INST,  35, { 0 } },
+	{ "SlapBass1",            INST,  36, { 0 } },
+	{ "SlapBass2",            INST,  37, { 0 } },
+	{ "SynthBass1",           INST,  38, { 0 } },
+	{ "SynthBass2",           INST,  39, { 0 } },
+	{ "Violin",               INST,  40, { 0 } },
+	{ "Viola",                INST,  41, { 0 } },
+	{ "Cello",                INST,  42, { 0 } },
+	{ "Contrabass",           INST,  43, { 0 } },
+	{ "TremoloStrings",       INST,  44, { 0 } },
+	{ "PizzicatoStrings",     INST,  45, { 0 } },
+	{ "OrchestralHarp",       INST,  46, { 0 } },
+	{ "Timpani",              INST,  47, { 0 } },
+	{ "StringEnsemble1",      INST,  48, { 0 } },
+	{ "StringEnsemble2",      INST,  49, { 0 } },
+	{ "SynthStrings1",        INST,  50, { 0 } },
+	{ "SynthStrings2",        INST,  51, { 0 } },
+	{ "ChoirAahs",            INST,  52, { 0 } },
+	{ "VoiceOohs",            INST,  53, { 0 } },
+	{ "SynthVoice",           INST,  54, { 0 } },
+	{ "OrchestraHit",         INST,  55, { 0 } },
+	{ "Trumpet",              INST,  56, { 0 } },
+	{ "Trombone",             INST,  57, { 0 } },
+	{ "Tuba",                 INST,  58, { 0 } },
+	{ "MutedTrumpet",         INST,  59, { 0 } },
+	{ "FrenchHorn",           INST,  60, { 0 } },
+	{ "BrassSection",         INST,  61, { 0 } },
+	{ "SynthBrass1",          INST,  62, { 0 } },
+	{ "SynthBrass2",          INST,  63, { 0 } },
+	{ "SopranoSax",           INST,  64, { 0 } },
+	{ "AltoSax",              INST,  65, { 0 } },
+	{ "TenorSax",             INST,  66, { 0 } },
+	{ "BaritoneSax",          INST,  67, { 0 } },
+	{ "Oboe",                 INST,  68, { 0 } },
+	{ "EnglishHorn",          INST,  69, { 0 } },
+	{ "Bassoon",              INST,  70, { 0 } },
+	{ "Clarinet",             INST,  71, { 0 } },
+	{ "Piccolo",              INST,  72, { 0 } },
+	{ "Flute",                INST,  73, { 0 } },
+	{ "Recorder",             INST,  74, { 0 } },
+	{ "PanFlute",             INST,  75, { 0 } },
+	{ "BlownBottle",          INST,  76, { 0 } },
+	{ "Shakuhachi",           INST,  77, { 0 } },
+	{ "Whistle",              INST,  78, { 0 } },
+	{ "Ocarina",              INST,  79, { 0 } },
+	{ "LeadSquare",           INST,  80, { 0 } },
+	{ "LeadSawtooth",         INST,  81, { 0 } },
+	{ "LeadCalliope",         INST,  82, { 0 } },
+	{ "LeadChiff",            INST,  83, { 0 } },
+	{ "LeadCharang",          INST,  84, { 0 } },
+	{ "LeadVoice",            INST,  85, { 0 } },
+	{ "LeadFifths",           INST,  86, { 0 } },
+	{ "LeadBassLead",         INST,  87, { 0 } },
+	{ "PadNewAge",            INST,  88, { 0 } },
+	{ "PadWarm",              INST,  89, { 0 } },
+	{ "PadPolysynth",         INST,  90, { 0 } },
+	{ "PadChoir",             INST,  91, { 0 } },
+	{ "PadBowed",             INST,  92, { 0 } },
+	{ "PadMetallic",          INST,  93, { 0 } },
+	{ "PadHalo",              INST,  94, { 0 } },
+	{ "PadSweep",             INST,  95, { 0 } },
+	{ "FxRain",               INST,  96, { 0 } },
+	{ "FxSoundtrack",         INST,  97, { 0 } },
+	{ "FxCrystal",            INST,  98, { 0 } },
+	{ "FxAtmosphere",         INST,  99, { 0 } },
+	{ "FxBrightness",         INST, 100, { 0 } },
+	{ "FxGoblins",            INST, 101, { 0 } },
+	{ "FxEchoes",             INST, 102, { 0 } },
+	{ "FxSciFi",              INST, 103, { 0 } },
+	{ "Sitar",                INST, 104, { 0 } },
+	{ "Banjo",                INST, 105, { 0 } },
+	{ "Shamisen",             INST, 106, { 0 } },
+	{ "Koto",                 INST, 107, { 0 } },
+	{ "Kalimba",              INST, 108, { 0 } },
+	{ "Bagpipe",              INST, 109, { 0 } },
+	{ "Fiddle",               INST, 110, { 0 } },
+	{ "Shanai",               INST, 111, { 0 } },
+	{ "TinkleBell",           INST, 112, { 0 } },
+	{ "Agogo",                INST, 113, { 0 } },
+	{ "SteelDrums",           INST, 114, { 0 } },
+	{ "Woodblock",            INST, 115, { 0 } },
+	{ "TaikoDrum",            INST, 116, { 0 } },
+	{ "MelodicTom",           INST, 117, { 0 } },
+	{ "SynthDrum",            INST, 118, { 0 } },
+	{ "ReverseCymbal",        INST, 119, { 0 } },
+	{ "GuitarFretNoise",      INST, 120, { 0 } },
+	{ "BreathNoise",          INST, 121, { 0 } },
+	{ "Seashore",             INST, 122, { 0 } },
+	{ "BirdTweet",            INST, 123, { 0 } },
+	{ "TelephoneRing",        INST, 124, { 0 } },
+	{ "Helicopter",           INST, 125, { 0 } },
+	{ "Applause",             INST, 126, { 0 } },
+	{ "Gunshot",              INST, 127, { 0 } },
+};
+
+#define BUILTIN_CHORDS		 27		// number of built-in chord types
+#define BUILTIN_BUCKETS		128		// perfect hash: buckets for first hash
+#define BUILTIN_SLOTS		512		// perfect hash: slots for second hash
+
+// perfect hash (hash and displace): the first hash selects a bucket, the seed of 
+// the bucket gives a collision free slot for all names of the bucket.
+// builtinSeed and builtinSlot are generated by mkbuiltin.c, rerun it after any 
+// change of builtin[]
+//
+DWORD builtin_hash(DWORD seed, BYTE type, const char *name, int len) {
+	DWORD h = 2166136261u ^ (seed * 0x9E3779B9u);
+	h = (h ^ type) * 16777619u;
+	for ( int i = 0; i < len; i++ ) h = (h ^ (BYTE)name[i]) * 16777619u;
+	h ^= h >> 15; h *= 0x2C1B3C6Du; h ^= h >> 12;
+	return h;
 }
 
-// free objects
-void freeObjects() {
-	void *p;
-	smsObject *obj = objFirst;
-	while (obj) {
-		switch (obj->type) {
-			case INST:	{	smsTrack *p = obj->obj;
-							free(p->name);
-							free(p);
-							break;
-						}
-			case DRUM: 	{	smsDrumKey *p = obj->obj;
-							free(p->name);
-							free(p);
-							break;
-						}
-			case CHORD: {	smsChord *p = obj->obj;
-							free(p->name);
-							free(p);
-							break;
-						}
-			case ARP: 
-			case MACRO: {	smsMacro *p = obj->obj;
-							free(p->name);
-							free(p->list);
-							free(p);
-							break;
-						}
-			default:	break;
-		}
-		smsObject *obj_old = obj;
-		obj = obj_old->next;
-		free(obj_old->name);
-		free(obj_old);
-	}
-	objFirst = NULL; objLast = NULL;			// reset object link list
-	return;
+// generated by mkbuiltin.c (210 names)
+const WORD builtinSeed[BUILTIN_BUCKETS] = {
+	    1,    1,    0,    0,    1,    0,    1,    0,    1,    1,    2,    1,    1,    1,    0,    1,
+	    1,    0,    1,    0,    1,    2,    1,    0,    1,    1,    1,    2,    3,    1,    0,    3,
+	    1,    1,    1,    1,    1,    1,    1,    2,    5,    2,    1,    1,    3,    2,    2,    4,
+	    3,    1,    1,    0,    1,    0,    0,    5,    1,    2,    2,    2,    2,    0,    1,    1,
+	    2,    1,    0,    0,    1,    1,    1,    2,    1,    0,    0,    0,    2,    1,    3,    1,
+	    2,    1,    1,    1,    3,    0,    1,    2,    1,    1,    2,    2,    1,    2,    1,    1,
+	    1,    2,    4,    6,    0,    1,    1,    0,    1,    0,    1,    1,    2,    1,    1,    1,
+	    1,    1,    1,    1,    2,    1,    1,    1,    2,    1,    4,    1,    2,    0,    2,    1,
+};
+const WORD builtinSlot[BUILTIN_SLOTS] = {
+	   20,  134,    0,  111,  189,    0,    0,    0,   61,    0,    0,   59,    0,    0,   76,    0,
+	  167,    0,  198,  207,   62,    0,    0,   32,    0,    0,    0,    0,  170,    0,   70,    0,
+	    0,  128,  101,   52,    0,    0,    0,   26,  180,    0,    0,    0,  182,   50,  102,   39,
+	    0,   49,    0,    0,    0,    0,    0,    0,    1,    0,    0,    0,    4,   60,    0,    0,
+	  109,    0,    0,   94,  165,    0,    0,  112,    0,   17,    0,   90,  107,    0,   71,    0,
+	    0,    0,   83,  158,    0,  144,    0,  148,    0,    0,    0,    0,   92,    0,    0,    0,
+	   19,    0,    2,    0,    0,    0,    0,    0,    0,   43,    0,    0,  143,    0,   48,   65,
+	    0,   51,  127,    0,    0,    0,   84,    0,    0,   46,    0,  194,  172,    0,    0,  193,
+	    0,    0,    0,  132,    0,    0,    0,    0,    0,   87,  154,    0,  136,  159,   56,    0,
+	    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,  150,    0,  126,   15,
+	  164,    0,    0,    0,    0,    0,  157,    0,    0,    0,    0,   41,    0,    0,  140,    0,
+	   12,    0,   53,  130,    0,    0,    0,  141,    0,    0,    5,    0,  120,  153,  129,   45,
+	   30,    0,    0,    0,    0,   14,  190,  200,    0,    0,   85,    0,    0,    0,  100,    0,
+	  103,    0,    0,  204,    0,    0,  181,    0,    0,    0,    0,  168,    0,   66,    0,   24,
+	    0,  133,  108,    0,  118,    0,   27,    0,    0,    0,    0,  177,  174,    0,    0,  196,
+	  179,   75,    0,    0,   67,    0,    0,    0,    0,    0,  149,   91,    0,    0,    0,   97,
+	  110,    0,    0,    0,    0,    0,    0,   79,    0,    0,    0,   72,    0,   57,   80,  169,
+	    0,   74,   69,    0,   63,    0,  197,  201,    6,    0,    0,   47,    0,    0,  115,  156,
+	    0,    0,   98,    0,   86,    0,    0,    0,    0,    0,  166,    0,    0,    0,  135,  147,
+	    0,    0,  104,    0,    0,    0,  183,   18,    0,    0,    0,   36,    0,    0,    0,  206,
+	    0,    0,    0,    0,    0,    0,  162,  146,    0,    0,    0,    0,    0,  116,    0,  131,
+	   93,    0,  185,    0,    0,  178,    0,    0,    0,    0,  208,    0,    0,   35,  124,  187,
+	   81,    0,  113,   55,    0,  119,    0,   99,  125,    0,  105,    0,    0,    0,  123,    0,
+	    0,    0,    0,    0,  171,    0,    0,   73,    0,  122,    0,   58,   21,    0,    0,  191,
+	   28,    0,  163,  210,    0,   95,    0,    0,    0,    0,    0,   96,   38,   77,   40,    0,
+	  152,  160,    0,    0,  137,   89,   78,   42,    0,   29,    0,    0,    0,  142,  195,    0,
+	    0,  155,    0,    9,    0,    0,    0,    0,  106,    0,   37,   16,   10,   88,    0,  173,
+	    0,    0,   11,  203,  145,    0,    0,    0,  186,  151,    0,   34,   82,  188,    0,    0,
+	  199,    0,    0,  139,   54,    0,   23,    0,    0,    0,   25,    0,    0,   13,    0,    0,
+	    0,    0,    0,    0,  184,  192,    0,  202,    0,    0,   31,   68,    0,   22,    0,    3,
+	    0,    8,  176,    0,    0,  117,    0,    0,    0,   64,    0,  209,    0,    0,  114,    0,
+	    0,  161,    0,    0,   44,    0,    7,    0,    0,    0,  175,   33,    0,  121,  138,  205,
+};
+
+// get built-in entry of name and type, returns EMPTY_ID if not found
+int builtin_find(BYTE type, const char *name, int len) {
+	DWORD h = builtin_hash(0, type, name, len);
+	DWORD g = builtin_hash(builtinSeed[h % BUILTIN_BUCKETS], type, name, len);
+	int   i = builtinSlot[g % BUILTIN_SLOTS] - 1;
+	if ( i < 0 || builtin[i].type != type ) 						return EMPTY_ID;
+	if ( strncmp(builtin[i].name, name, len) || builtin[i].name[len] ) 	return EMPTY_ID;
+	return i;
 }
 
-// create sms note event with default values
-smsNote *newSmsNote() {
-	smsNote *n = (smsNote*)calloc(1, sizeof(smsNote));
-		n->key 		= 0;
-		n->hft 		= 0;
-		n->oct 		= DEFAULT_OCTAVE;
-		n->dur 		= DEFAULT_DURATION;
-		n->dot 		= 0;
-		n->hold 	= EMPTY;
-		n->vol 		= DEFAULT_VOLUME;
-	return n;
+/***************************************************************************
+ * sms functions
+ ***************************************************************************/
+ 
+// memory of compiler from allocator of context
+void *sms_realloc(smsCtx *ctx, void *mem, size_t size) {
+	if ( !size ) size = 1;										// size 0 frees memory
+	return ctx->mem.func(ctx->mem.arg, mem, size);
 }
 
-// create sms chord note event with default values
-smsChordNote *newSmsCNote() {
-	smsChordNote *cn = (smsChordNote*)calloc(1, sizeof(smsChordNote));
-		cn->key = 0;
-		cn->hft = 0;
-		cn->chord = NULL;
-		cn->arp   = NULL;
-	return cn;
+void *sms_malloc(smsCtx *ctx, size_t size) {
+	return sms_realloc(ctx, NULL, size);
 }
 
-// create sms chord with default values
-smsChord *newSmsChord(char* name) {
-	int type;
-	if ( getObject(name, &type) != NULL ) return NULL;						// check if name exist
-	smsChord *c = (smsChord*)calloc(1, sizeof(smsChord));
-		c->name   = (char*)malloc(strlen(name)); strcpy(c->name, name);
-		c->keys   = (BYTE*)malloc(CHORD_KEYS);
-		for(int i = 0; i < CHORD_KEYS; i++) c->keys[i] = EMPTY;
-	newSmsObject(name, CHORD, c);
-	return c;
+void *sms_calloc(smsCtx *ctx, size_t size) {
+	void *mem = sms_realloc(ctx, NULL, size);
+	memset(mem, 0, size);
+	return mem;
 }
 
-// create sms macro 
-smsMacro *newSmsMacro(char *name, int mode) {
-	int type;
-	if ( getObject(name, &type) != NULL ) return NULL;						// check if name exist
-	smsMacro *mac = (smsMacro*)calloc(1, sizeof(smsMacro));
-		mac->name 		= (char*)malloc(strlen(name)); strcpy(mac->name, name);
-		mac->startline 	= 0;
-		mac->lines 		= 0;
-		mac->cmd  		= mode;
-		mac->list 		= (char*)calloc(1, sizeof(char));
-		mac->size 		= 0;
-	newSmsObject(name, mode, mac);
-	return mac;
+void sms_free(smsCtx *ctx, void *mem) {
+	if ( mem ) ctx->mem.func(ctx->mem.arg, mem, 0);
+	return;
 }
 
-// create sms event
-smsEvent *newSmsEvent(smsTrack *trk, int evtId, int time, BYTE status, BYTE data1, BYTE data2) {
-	smsEvent *evt = (smsEvent*)calloc(1, sizeof(smsEvent));
-		evt->trkname = trk->name;
-		evt->evtId	 = evtId;
-		evt->time 	 = time;
-		evt->status  = status;
-		evt->data1   = data1;
-		evt->data2   = data2;
-		evt->bpm     = 0;
-		evt->next	 = NULL;
-	if ( !evtFirst ) evtFirst      = evt;
-	if ( evtLast )   evtLast->next = evt;
-	evtLast = evt;
-	return evt;
-}
-
-void freeEvents() {
-	smsEvent *evt = evtFirst, *evt_old;
-	while (evt) { 
-		evt_old = evt;
-		evt     = evt_old->next;
-		free(evt_old->trkname);
-		free(evt_old);
-	}
-	evtFirst = NULL; evtLast = NULL;			// reset event link list
+// default allocator (c library)
+void *sms_allocDefault(void *arg, void *mem, size_t size) {
+	(void)arg;											// no state
+	if ( size ) return realloc(mem, size);
+	free(mem);
+	return NULL;
 }
 
-// create new sms instrument track with default values
-smsTrack *newSmsTrk(char *name) {
-	int type;
-	if ( getObject(name, &type) != NULL ) 					return NULL;	// check if name exist
-	smsTrack *trk = (smsTrack*)calloc(1, sizeof(smsTrack));
-		trk->name  = (char*)malloc(strlen(name)); strcpy(trk->name, name);
-		trk->chn   = 0;	 
-		trk->bnk   = 0; 
-		trk->prg   = 0;
-		trk->note  = newSmsNote();
-		trk->cnote = newSmsCNote();
-	newSmsObject(name, INST, trk);
-	return trk;
+// keep freed object for reuse
+void spare_put(smsCtx *ctx, int type, void *obj) {
+	smsSpare *sp = &ctx->spare[type];
+	if ( sp->cnt == sp->max ) {
+		sp->max = ( sp->max ) ? sp->max * 2 : 64;
+		sp->obj = (void**)sms_realloc(ctx, sp->obj, sp->max * sizeof(void*));
+	}
+	sp->obj[sp->cnt++] = obj;
+	return;
 }
 
-// create new sms drum key with default values
-smsDrumKey *newSmsDrumKey(char *name) {
-	int type;
-	if ( getObject(name, &type) != NULL ) 					return NULL;	// check if name exist
-	smsDrumKey *dkey = (smsDrumKey*)calloc(1, sizeof(smsDrumKey));
-		dkey->name 	 = (char*)malloc(strlen(name)); strcpy(dkey->name, name);
-		dkey->key    = 31;				// tick		
-	newSmsObject(name, DRUM, dkey);
-	return dkey;
+// get freed object of type, NULL if none
+void *spare_get(smsCtx *ctx, int type) {
+	smsSpare *sp = &ctx->spare[type];
+	return ( sp->cnt ) ? sp->obj[--sp->cnt] : NULL;
 }
 
-// create sms header with default values
-smsHeader *initSMS(char *name) {
-	smsHeader *sms  = (smsHeader*) malloc(sizeof(smsHeader));
-		sms->name 		= (char*)malloc(strlen(name)); strcpy(sms->name, name);
-		sms->bpm		=	DEFAULT_BPM;
-		sms->ppqn		=	DEFAULT_PPQN;
-		sms->bar		=	sms->ppqn * 4;		// 4/4 -> 4 * 96
-		sms->drk		=     0;
-		sms->trks		=	  0;
-		sms->drumkeys 	=     0;
-		sms->macs		=	  0;
-		sms->evts		=	  0;
-		sms->chords		=	  0;
-		sms->arps		=	  0;
-	// reset internal variables	
-	parserPos = 0;								// for multiple use
-	freeObjects();
-	freeEvents();
-	return sms;
+// hash value of name (fnv-1a)
+DWORD sym_hash(const char *name, int len) {
+	DWORD h = 2166136261u;
+	for ( int i = 0; i < len; i++ ) h = (h ^ (BYTE)name[i]) * 16777619u;
+	return h;
 }
 
-void freeSMS(smsHeader *sms) {
-	freeObjects();
-	freeEvents();
-	free(sms->name);
-	free(sms);
+// get interned name of symbol
+char *sym_name(smsCtx *ctx, int id) {
+	return ctx->symtab.names + ctx->symtab.sym[id].name;
 }
 
-/***************************************************************************
- * read file to memory
- ***************************************************************************/
- 
-char *get_file_to_mem(char fileName[]) {
-	FILE  *fp = fopen(fileName, "r");
-	if(!fp) return NULL;
-	fseek(fp, 0, SEEK_END);
-	int size = ftell(fp);
-	char *buf = (char*)calloc(size+1, sizeof(char));
-	fseek(fp, 0, SEEK_SET);
-	fread(buf, size, 1, fp);
-	fclose(fp);
-	return buf;
+// get object of symbol
+void *sym_object(smsCtx *ctx, int id) {
+	return ctx->symtab.sym[id].obj;
 }
 
-int clear_mem(char *buf) { free(buf); }
+// get hash table slot of name, slot is free if name is unknown
+int sym_slot(smsCtx *ctx, const char *name, int len, DWORD hash) {
+	smsSymtab *symtab = &ctx->symtab;
+	int mask = symtab->size - 1;
+	int i    = hash & mask;
+	while ( symtab->slot[i] ) {
+		smsSymbol *sym = &symtab->sym[symtab->slot[i] - 1];
+		if ( sym->hash == hash && sym->len == len &&
+			 memcmp(symtab->names + sym->name, name, len) == 0 ) break;
+		i = (i + 1) & mask;									// linear probing
+	}
+	return i;
+}
 
-/***************************************************************************
- * token parser functions
- ***************************************************************************/
+// get symbol id and type of existing name, returns EMPTY_ID if name is unknown
+int sym_find(smsCtx *ctx, const char *name, int len, int *type) {
+	if ( !ctx->symtab.size ) return EMPTY_ID;
+	int id = ctx->symtab.slot[sym_slot(ctx, name, len, sym_hash(name, len))] - 1;
+	if ( id != EMPTY_ID ) *type = ctx->symtab.sym[id].type;
+	return id;
+}
 
-// read the next word, return token for single_char word
-int parser_next(char **word, char *data) {	
-	int pos = parserPos;								// current pointer position
-	int c;												// current single_char
-	int strSize = strlen(data);							// data size
-	if (pos >= strSize) return EOD;						// end of data
-
-	char *buf = (char*)calloc(255, sizeof(char));		// initialize pointer for buffer with \0
-	int cnt = 0;										// counter of read characters
-	int eow = FALSE;									// flag for end of word
-	while ( pos < strSize ) {							// read loop
-		if(cnt > 253) 	break;							// word ist to long
-		c 	= data[pos++];								// get next character
-		switch ( c ) {
-			case CARRIAGE_RETURN:
-			case NEWLINE:	if(cnt)  pos--; 			// new line at end of word
-							if(!cnt) buf[cnt++] = c;	// new line at begin of word
-							eow = TRUE;
-							break;
-			case TAB:
-			case SPACE:		if(cnt) eow = TRUE; break;			
-			default:		buf[cnt++]  = c; 	break;
-		}
-		if(eow) break;									// end of word
+// insert all symbols into empty hash table
+void sym_fill(smsSymtab *symtab) {
+	for ( int id = 0; id < symtab->cnt; id++ ) {
+		int i = symtab->sym[id].hash & (symtab->size - 1);
+		while ( symtab->slot[i] ) i = (i + 1) & (symtab->size - 1);
+		symtab->slot[i] = id + 1;
 	}
-	*word = buf;
-	parserPos = pos; 
-	return (cnt == 1) ? buf[0] : UNKNOWN;				// return token
+	return;
 }
-		
-// check if char alphanumeric
-int parser_isChar(BYTE c) {
-	// A = 65 ... Z = 90, // a = 97 ... z = 122
-	if(c > 64 && c <  91) return TRUE;
-	if(c > 96 && c < 123) return TRUE;
-	return FALSE;
+
+// double size of hash table and insert all symbols again
+void sym_rehash(smsCtx *ctx) {
+	smsSymtab *symtab = &ctx->symtab;
+	sms_free(ctx, symtab->slot);
+	symtab->size = ( symtab->size ) ? symtab->size * 2 : SYMTAB_SIZE;
+	symtab->slot = (int*)sms_calloc(ctx, symtab->size * sizeof(int));
+	sym_fill(symtab);
+	return;
 }
 
-// get number from start of string, return count of size in char
-int parser_getNumber(char *p, int *value) {
-	if (strcmp(p, "EMPTY")  == 0) {
-		*value = EMPTY;
-		return strlen(p);
+// create symbol with interned name, returns symbol id or EMPTY_ID if name exist
+int sym_add(smsCtx *ctx, const char *name, int len, BYTE type, void *object) {
+	smsSymtab *symtab = &ctx->symtab;
+	if ( (symtab->cnt + 1) * 2 > symtab->size ) sym_rehash(ctx);	// load factor max. 1/2
+	DWORD hash = sym_hash(name, len);
+	int i = sym_slot(ctx, name, len, hash);
+	if ( symtab->slot[i] ) return EMPTY_ID;						// name exist
+	if ( symtab->cnt == symtab->max ) {
+		symtab->max = ( symtab->max ) ? symtab->max * 2 : SYMTAB_SIZE;
+		symtab->sym = (smsSymbol*)sms_realloc(ctx, symtab->sym, symtab->max * sizeof(smsSymbol));
 	}
-	int v = p[0]; int count = 0;
-	*value = 0;
-	while( v-48 >=0 &&  v-48 <= 9) {
-		*value = *value * 10 + (v-48);
-		p++; count++;
-		v = p[0];
+	while ( symtab->namesLen + len + 1 > symtab->namesMax ) {
+		symtab->namesMax = ( symtab->namesMax ) ? symtab->namesMax * 2 : SYMTAB_SIZE * 16;
+		symtab->names    = (char*)sms_realloc(ctx, symtab->names, symtab->namesMax);
 	}
-	return count;	
+	smsSymbol *sym = &symtab->sym[symtab->cnt];
+		sym->name = symtab->namesLen;
+		sym->len  = len;
+		sym->hash = hash;
+		sym->type = type;
+		sym->obj  = object;
+	memcpy(symtab->names + symtab->namesLen, name, len);
+	symtab->names[symtab->namesLen + len] = '\0';
+	symtab->namesLen += len + 1;
+	symtab->slot[i]   = ++symtab->cnt;
+	return symtab->cnt - 1;
 }
 
-// check repeater command 
-int parser_isRepeater(char *word, int *value) {
-	int v=-1;
-	int res = sscanf(word, "*%d", &v);
-	if ( res !=1 ) 						return ERR_DEF_PARAMETER;
-	*value = v;
-	return ERR_NOERROR;
+// remove symbols from id on (objects are freed before), hash table is built again
+void sym_truncate(smsCtx *ctx, int cnt) {
+	smsSymtab *symtab = &ctx->symtab;
+	if ( cnt >= symtab->cnt ) return;
+	symtab->namesLen = symtab->sym[cnt].name;
+	symtab->cnt      = cnt;
+	memset(symtab->slot, 0, symtab->size * sizeof(int));
+	sym_fill(symtab);
+	return;
+}
+
+// word cache of parser, returns entry id of word or EMPTY_ID
+int memo_find(smsCtx *ctx, const char *word, int len, BYTE type, DWORD hash) {
+	smsMemo *memo = &ctx->memo;
+	if ( !memo->size ) return EMPTY_ID;
+	int mask = memo->size - 1;
+	int i    = hash & mask;
+	while ( memo->slot[i] ) {
+		smsMemoEntry *e = &memo->ent[memo->slot[i] - 1];
+		if ( e->hash == hash && e->type == type && e->len == len &&
+			 memcmp(memo->words + e->word, word, len) == 0 ) return memo->slot[i] - 1;
+		i = (i + 1) & mask;
+	}
+	return EMPTY_ID;
+}
+
+// resize hash table of word cache
+void memo_rehash(smsCtx *ctx) {
+	smsMemo *memo = &ctx->memo;
+	sms_free(ctx, memo->slot);
+	memo->size = ( memo->size ) ? memo->size * 2 : MEMO_SIZE;
+	memo->slot = (int*)sms_calloc(ctx, memo->size * sizeof(int));
+	for ( int id = 0; id < memo->cnt; id++ ) {
+		int i = memo->ent[id].hash & (memo->size - 1);
+		while ( memo->slot[i] ) i = (i + 1) & (memo->size - 1);
+		memo->slot[i] = id + 1;
+	}
+}
+
+// add word to cache (word must not exist), returns entry id
+int memo_add(smsCtx *ctx, const char *word, int len, BYTE type, DWORD hash) {
+	smsMemo *memo = &ctx->memo;
+	if ( (memo->cnt + 1) * 2 > memo->size ) memo_rehash(ctx);		// load factor max. 1/2
+	if ( memo->cnt == memo->max ) {
+		memo->max = ( memo->max ) ? memo->max * 2 : MEMO_SIZE;
+		memo->ent = (smsMemoEntry*)sms_realloc(ctx, memo->ent, memo->max * sizeof(smsMemoEntry));
+	}
+	while ( memo->wordsLen + len > memo->wordsMax ) {
+		memo->wordsMax = ( memo->wordsMax ) ? memo->wordsMax * 2 : MEMO_SIZE * 8;
+		memo->words    = (char*)sms_realloc(ctx, memo->words, memo->wordsMax);
+	}
+	smsMemoEntry *e = &memo->ent[memo->cnt];
+	memset(e, 0, sizeof(smsMemoEntry));
+		e->word = memo->wordsLen;
+		e->len  = len;
+		e->hash = hash;
+		e->type = type;
+	memcpy(memo->words + memo->wordsLen, word, len);
+	memo->wordsLen += len;
+	int i = hash & (memo->size - 1);
+	while ( memo->slot[i] ) i = (i + 1) & (memo->size - 1);
+	memo->slot[i] = ++memo->cnt;
+	return memo->cnt - 1;
+}
+
+// clear word cache and statistic, memory is kept
+void clearMemo(smsCtx *ctx) {
+	smsMemo *memo = &ctx->memo;
+	if ( memo->slot ) memset(memo->slot, 0, memo->size * sizeof(int));
+	memo->cnt      = 0;
+	memo->wordsLen = 0;
+	memo->hits     = memo->misses = 0;
+	return;
+}
+
+// free word cache
+void freeMemo(smsCtx *ctx) {
+	sms_free(ctx, ctx->memo.ent);
+	sms_free(ctx, ctx->memo.slot);
+	sms_free(ctx, ctx->memo.words);
+	memset(&ctx->memo, 0, sizeof(smsMemo));			// reset word cache and statistic
+}
+
+// remove all events, memory is kept
+void evt_clear(smsEvents *e) {
+	e->cnt    = 0;
+	e->tempos = 0;
+	e->refs   = 0;
+	return;
+}
+
+void freeEvents(smsCtx *ctx, smsEvents *e) {
+	sms_free(ctx, e->time);
+	sms_free(ctx, e->trk);
+	sms_free(ctx, e->evtId);
+	sms_free(ctx, e->status);
+	sms_free(ctx, e->data1);
+	sms_free(ctx, e->data2);
+	sms_free(ctx, e->tempo);
+	sms_free(ctx, e->ref);
+	memset(e, 0, sizeof(smsEvents));			// reset event store
+}
+
+// get block, freed block is reused with memory of track states and events
+smsBlock *block_new(smsCtx *ctx) {
+	smsBlock *blk = spare_get(ctx, SPARE_BLOCK);
+	if ( !blk ) return (smsBlock*)sms_calloc(ctx, sizeof(smsBlock));
+	smsTrkState *trkIn = blk->trkIn, *trkOut = blk->trkOut;
+	int          max   = blk->trksMax;
+	smsEvents    evt   = blk->evt;
+	memset(blk, 0, sizeof(smsBlock));
+	blk->trkIn   = trkIn;
+	blk->trkOut  = trkOut;
+	blk->trksMax = max;
+	blk->evt     = evt;
+	evt_clear(&blk->evt);
+	return blk;
+}
+
+// free compiled event block (kept for reuse)
+void block_free(smsCtx *ctx, smsBlock *blk) {
+	spare_put(ctx, SPARE_BLOCK, blk);
+	return;
+}
+
+// free compiled event blocks of macro
+void freeBlocks(smsCtx *ctx, smsMacro *mac) {
+	smsBlock *blk = mac->blocks, *blk_old;
+	while (blk) {
+		blk_old = blk;
+		blk     = blk_old->next;
+		block_free(ctx, blk_old);
+	}
+	mac->blocks   = NULL;
+	mac->variants = 0;
+}
+
+// free objects from symbol id on (kept for reuse)
+void freeObjectsFrom(smsCtx *ctx, int from) {
+	for ( int id = from; id < ctx->symtab.cnt; id++ ) {
+		smsSymbol *sym = &ctx->symtab.sym[id];
+		switch (sym->type) {
+			case INST:	spare_put(ctx, SPARE_TRK, sym->obj);
+						break;
+			case CHORD: spare_put(ctx, SPARE_CHORD, sym->obj);
+						break;
+			case ARP:
+			case MACRO: freeBlocks(ctx, sym->obj);
+						spare_put(ctx, SPARE_MACRO, sym->obj);
+						break;
+			default:	spare_put(ctx, SPARE_DKEY, sym->obj);
+						break;
+		}
+	}
+	sym_truncate(ctx, from);
+	return;
+}
+
+// free objects, memory of symbol table is kept
+void freeObjects(smsCtx *ctx) {
+	freeObjectsFrom(ctx, 0);
+	return;
+}
+
+// set default values of sms note event
+void initSmsNote(smsNote *n) {
+		n->key 		= 0;
+		n->hft 		= 0;
+		n->oct 		= DEFAULT_OCTAVE;
+		n->dur 		= DEFAULT_DURATION;
+		n->dot 		= 0;
+		n->hold 	= EMPTY;
+		n->vol 		= DEFAULT_VOLUME;
+	return;
+}
+
+// set default values of sms chord note event
+void initSmsCNote(smsChordNote *cn) {
+		cn->key   = 0;
+		cn->hft   = 0;
+		cn->chord = NULL;
+		cn->arp   = NULL;
+	return;
+}
+
+// create sms chord with default values
+smsChord *newSmsChord(smsCtx *ctx, const char* name, int len) {
+	smsChord *c = spare_get(ctx, SPARE_CHORD);
+	if ( !c ) {
+		c = (smsChord*)sms_calloc(ctx, sizeof(smsChord));
+		c->keys = (BYTE*)sms_malloc(ctx, CHORD_KEYS);
+	}
+		c->id     = sym_add(ctx, name, len, CHORD, c);
+		if ( c->id == EMPTY_ID ) { spare_put(ctx, SPARE_CHORD, c); return NULL; }	// name exist
+		for(int i = 0; i < CHORD_KEYS; i++) c->keys[i] = EMPTY;
+	return c;
+}
+
+// create sms macro, freed macro is reused with memory of word list, steps and dependencies
+smsMacro *newSmsMacro(smsCtx *ctx, const char *name, int len, int mode) {
+	smsMacro *mac = spare_get(ctx, SPARE_MACRO);
+	if ( !mac ) mac = (smsMacro*)sms_calloc(ctx, sizeof(smsMacro));
+		mac->id 		= sym_add(ctx, name, len, mode, mac);
+		if ( mac->id == EMPTY_ID ) { spare_put(ctx, SPARE_MACRO, mac); return NULL; }	// name exist
+		mac->startline 	= 0;
+		mac->lines 		= 0;
+		mac->cmd  		= mode;
+		mac->size 		= 0;
+		mac->blocks		= NULL;
+		mac->variants	= 0;
+		mac->active		= FALSE;
+		mac->steps		= 0;
+		mac->stepPpqn	= 0;
+		mac->depCnt		= 0;
+		mac->depSyms	= EMPTY_ID;
+		mac->mark		= 0;
+	return mac;
+}
+
+// add word to macro list
+void addSmsMacroWord(smsCtx *ctx, smsMacro *mac, smsToken *tok) {
+	if ( mac->size == mac->max ) {
+		mac->max  = ( mac->max ) ? mac->max * 2 : 16;
+		mac->list = (smsToken*)sms_realloc(ctx, mac->list, mac->max * sizeof(smsToken));
+	}
+	mac->list[mac->size++] = *tok;
+}
+
+// append event to event store
+void evt_push(smsCtx *ctx, smsEvents *e, int trk, int evtId, int time, BYTE status, BYTE data1, BYTE data2) {
+	if ( e->cnt == e->max ) {
+		e->max    = ( e->max ) ? e->max * 2 : 1024;
+		e->time   = (int*) sms_realloc(ctx, e->time,   e->max * sizeof(int));
+		e->trk    = (int*) sms_realloc(ctx, e->trk,    e->max * sizeof(int));
+		e->evtId  = (int*) sms_realloc(ctx, e->evtId,  e->max * sizeof(int));
+		e->status = (BYTE*)sms_realloc(ctx, e->status, e->max);
+		e->data1  = (BYTE*)sms_realloc(ctx, e->data1,  e->max);
+		e->data2  = (BYTE*)sms_realloc(ctx, e->data2,  e->max);
+	}
+	int i = e->cnt++;
+	e->time[i]   = time;
+	e->trk[i]    = trk;
+	e->evtId[i]  = evtId;
+	e->status[i] = status;
+	e->data1[i]  = data1;
+	e->data2[i]  = data2;
+	return;
+}
+
+// append tempo change to side table of event store
+void evt_pushTempo(smsCtx *ctx, smsEvents *e, int evtId, int bpm) {
+	if ( e->tempos == e->tempoMax ) {
+		e->tempoMax = ( e->tempoMax ) ? e->tempoMax * 2 : 16;
+		e->tempo    = (smsTempo*)sms_realloc(ctx, e->tempo, e->tempoMax * sizeof(smsTempo));
+	}
+	e->tempo[e->tempos++] = (smsTempo){ evtId, bpm };
+	return;
+}
+
+// append reference to macro event block
+void evt_pushRef(smsCtx *ctx, smsEvents *e, struct SMS_BLOCK *blk, int time, int evtId) {
+	if ( e->refs == e->refMax ) {
+		e->refMax = ( e->refMax ) ? e->refMax * 2 : 16;
+		e->ref    = (smsRef*)sms_realloc(ctx, e->ref, e->refMax * sizeof(smsRef));
+	}
+	e->ref[e->refs++] = (smsRef){ blk, time, evtId };
+	return;
+}
+
+// create sms event
+void newSmsEvent(smsCtx *ctx, smsTrack *trk, int evtId, int time, BYTE status, BYTE data1, BYTE data2) {
+	evt_push(ctx, &ctx->events, trk->id, evtId, time, status, data1, data2);
+	return;
+}
+
+// create tempo change, the event keeps the position in track and the side table the bpm value
+void newSmsTempo(smsCtx *ctx, smsTrack *trk, int evtId, int time, int bpm) {
+	evt_push(ctx, &ctx->events, trk->id, evtId, time, 0, 0, 0);
+	evt_pushTempo(ctx, &ctx->events, evtId, bpm);
+	return;
+}
+
+// create reference to macro event block, its events are numbered from evtId
+void newSmsBlockEvent(smsCtx *ctx, struct SMS_BLOCK *blk, int evtId, int time) {
+	evt_pushRef(ctx, &ctx->events, blk, time, evtId);
+	return;
+}
+
+// create new sms instrument track with default values
+smsTrack *newSmsTrk(smsCtx *ctx, const char *name, int len) {
+	smsTrack *trk = spare_get(ctx, SPARE_TRK);
+	if ( !trk ) {
+		trk = (smsTrack*)sms_calloc(ctx, sizeof(smsTrack));
+		trk->note  = (smsNote*)sms_malloc(ctx, sizeof(smsNote));
+		trk->cnote = (smsChordNote*)sms_malloc(ctx, sizeof(smsChordNote));
+	}
+		trk->id    = sym_add(ctx, name, len, INST, trk);
+		if ( trk->id == EMPTY_ID ) { spare_put(ctx, SPARE_TRK, trk); return NULL; }	// name exist
+		trk->chn   = 0;
+		trk->bnk   = 0;
+		trk->prg   = 0;
+		initSmsNote(trk->note);
+		initSmsCNote(trk->cnote);
+	return trk;
+}
+
+// create new sms drum key with default values
+smsDrumKey *newSmsDrumKey(smsCtx *ctx, const char *name, int len) {
+	smsDrumKey *dkey = spare_get(ctx, SPARE_DKEY);
+	if ( !dkey ) dkey = (smsDrumKey*)sms_calloc(ctx, sizeof(smsDrumKey));
+		dkey->id 	 = sym_add(ctx, name, len, DRUM, dkey);
+		if ( dkey->id == EMPTY_ID ) { spare_put(ctx, SPARE_DKEY, dkey); return NULL; }	// name exist
+		dkey->key    = 31;				// tick
+	return dkey;
+}
+
+// create sms header of context with default values
+smsHeader *initSMS(smsCtx *ctx, char *name) {
+	smsHeader *sms  = &ctx->sms;
+		snprintf(sms->name, BUFFER, "%s", name);
+		sms->bpm		=	DEFAULT_BPM;
+		sms->ppqn		=	DEFAULT_PPQN;
+		sms->bar		=	sms->ppqn * 4;		// 4/4 -> 4 * 96
+		sms->drk		=     0;
+		sms->sngTime	=	  0;
+		sms->trks		=	  0;
+		sms->drumkeys 	=     0;
+		sms->macs		=	  0;
+		sms->evts		=	  0;
+		sms->chords		=	  0;
+		sms->arps		=	  0;
+	// reset internal variables
+	freeObjects(ctx);
+	evt_clear(&ctx->events);
+	clearMemo(ctx);
+	ctx->cache.hits  = ctx->cache.misses = ctx->cache.stores = 0;
+	ctx->cache.saved = ctx->cache.io     = 0;
+	return sms;
+}
+
+void freeSMS(smsCtx *ctx) {
+	freeObjects(ctx);
+	evt_clear(&ctx->events);
+	return;
+}
+
+// create compiler context, mem: allocator (NULL: c library)
+smsCtx *newSmsCtx(smsAlloc *mem) {
+	smsAlloc alloc = ( mem ) ? *mem : (smsAlloc){ sms_allocDefault, NULL };
+	smsCtx  *ctx   = (smsCtx*)alloc.func(alloc.arg, NULL, sizeof(smsCtx));
+	if ( !ctx ) return NULL;
+	memset(ctx, 0, sizeof(smsCtx));
+	ctx->mem = alloc;
+	return ctx;
+}
+
+// free spare objects of type
+void freeSpare(smsCtx *ctx, int type) {
+	smsSpare *sp = &ctx->spare[type];
+	for ( int i = 0; i < sp->cnt; i++ ) {
+		switch ( type ) {
+			case SPARE_TRK:		{	smsTrack *p = sp->obj[i];
+									sms_free(ctx, p->note);
+									sms_free(ctx, p->cnote);
+									break;
+								}
+			case SPARE_CHORD:	sms_free(ctx, ((smsChord*)sp->obj[i])->keys);
+								break;
+			case SPARE_MACRO:	{	smsMacro *p = sp->obj[i];
+									sms_free(ctx, p->list);
+									sms_free(ctx, p->step);
+									sms_free(ctx, p->deps);
+									break;
+								}
+			case SPARE_BLOCK:	{	smsBlock *p = sp->obj[i];
+									sms_free(ctx, p->trkIn);
+									sms_free(ctx, p->trkOut);
+									freeEvents(ctx, &p->evt);
+									break;
+								}
+		}
+		sms_free(ctx, sp->obj[i]);
+	}
+	sms_free(ctx, sp->obj);
+	memset(sp, 0, sizeof(smsSpare));
+	return;
+}
+
+/***************************************************************************
+ * read file to memory
+ ***************************************************************************/
+ 
+// read whole stream into heap buffer (small files, pipes and stdin)
+smsFile *read_file_to_mem(FILE *fp, int size) {
+	smsFile *file = (smsFile*)calloc(1, sizeof(smsFile));
+	int cap = (size > 0) ? size : 4096;
+	file->data = (char*)malloc(cap);
+	while ( 1 ) {
+		int n = fread(file->data + file->len, 1, cap - file->len, fp);
+		file->len += n;
+		if ( n == 0 || file->len == size ) break;			// end of stream or known size
+		if ( file->len == cap ) {
+			cap *= 2;
+			file->data = (char*)realloc(file->data, cap);
+		}
+	}
+	file->mapped = FALSE;
+	return file;
+}
+
+// map script file read only into memory, "-" reads stdin,
+// the file must not be truncated while mapped (access beyond new end: SIGBUS), 
+// use get_file_to_buf for files rewritten by other programs (e.g. editor in live coding)
+smsFile *get_file_to_mem(char fileName[]) {
+	if ( strcmp(fileName, "-") == 0 ) return read_file_to_mem(stdin, 0);
+#ifdef _WIN32
+	HANDLE fh = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if ( fh == INVALID_HANDLE_VALUE ) return NULL;
+	LARGE_INTEGER fs;
+	int isDisk = GetFileType(fh) == FILE_TYPE_DISK && GetFileSizeEx(fh, &fs);
+	int size   = ( isDisk && fs.QuadPart < 0x7FFFFFFF ) ? (int)fs.QuadPart : 0;
+	if ( size >= MAP_MINSIZE ) {
+		HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+		void  *p  = (mh) ? MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0) : NULL;
+		if ( mh ) CloseHandle(mh);							// view keeps the mapping alive
+		if ( p ) {
+			CloseHandle(fh);
+			smsFile *file = (smsFile*)calloc(1, sizeof(smsFile));
+			file->data   = (char*)p;
+			file->len    = size;
+			file->mapped = TRUE;
+			return file;
+		}
+	}
+	CloseHandle(fh);
+	FILE *fp = fopen(fileName, "rb");
+	if ( !fp ) return NULL;
+	smsFile *file = read_file_to_mem(fp, size);
+#else
+	int fd = open(fileName, O_RDONLY);
+	if ( fd < 0 ) return NULL;
+	struct stat st;
+	int isReg = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+	int size  = ( isReg && st.st_size < 0x7FFFFFFF ) ? (int)st.st_size : 0;
+	if ( size >= MAP_MINSIZE ) {
+		void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( p != MAP_FAILED ) {								// else read it
+			close(fd);										// mapping stays valid
+			smsFile *file = (smsFile*)calloc(1, sizeof(smsFile));
+			file->data   = (char*)p;
+			file->len    = size;
+			file->mapped = TRUE;
+			return file;
+		}
+	}
+	FILE *fp = fdopen(fd, "rb");
+	if ( !fp ) { close(fd); return NULL; }
+	smsFile *file = read_file_to_mem(fp, size);
+#endif
+	fclose(fp);
+	return file;
+}
+
+// read file into heap buffer (not mapped), "-" reads stdin
+smsFile *get_file_to_buf(char fileName[]) {
+	if ( strcmp(fileName, "-") == 0 ) return read_file_to_mem(stdin, 0);
+	FILE *fp = fopen(fileName, "rb");
+	if ( !fp ) return NULL;
+	smsFile *file = read_file_to_mem(fp, 0);
+	fclose(fp);
+	return file;
+}
+
+// release script data
+void clear_mem(smsFile *file) {
+	if ( !file ) return;
+#ifdef _WIN32
+	if ( file->mapped ) UnmapViewOfFile(file->data);
+#else
+	if ( file->mapped ) munmap(file->data, file->len);
+#endif
+	if ( !file->mapped ) free(file->data);
+	free(file);
+	return;
+}
+
+// release mapped pages before position (data already read), keeps memory bounded for big files
+void release_mem(smsFile *file, int pos) {
+	if ( !file || !file->mapped ) return;
+#ifndef _WIN32
+	long page = sysconf(_SC_PAGESIZE);
+	long len  = pos / page * page;
+	if ( len > 0 ) madvise(file->data, len, MADV_DONTNEED);
+#endif
+	return;
+}
+
+/***************************************************************************
+ * token parser functions
+ ***************************************************************************/
+
+// word separators are tested 8 characters at once (swar),
+// SWAR_ZERO is not null if any byte of x is zero
+#define SWAR_ONES		0x0101010101010101ULL
+#define SWAR_HIGHS		0x8080808080808080ULL
+#define SWAR_ZERO(x)	(((x) - SWAR_ONES) & ~(x) & SWAR_HIGHS)
+
+// initialize lexer for script data with known size
+void lexer_init(smsLexer *lex, const char *data, int size) {
+	lex->data = data;
+	lex->len  = size;
+	lex->pos  = 0;
+	return;
+}
+
+// check is character a word separator
+int lexer_isSeparator(char c) {
+	return c == SPACE || c == TAB || c == NEWLINE || c == CARRIAGE_RETURN;
+}
+
+// check 8 characters at once for a word separator
+int lexer_hasSeparator(const char *p) {
+	unsigned long long w;
+	memcpy(&w, p, sizeof(w));
+	return ( SWAR_ZERO(w ^ (SWAR_ONES * SPACE))   | SWAR_ZERO(w ^ (SWAR_ONES * TAB)) |
+			 SWAR_ZERO(w ^ (SWAR_ONES * NEWLINE)) | SWAR_ZERO(w ^ (SWAR_ONES * CARRIAGE_RETURN)) ) != 0;
+}
+
+// read the next word as view into script data, return token for single_char word
+int lexer_next(smsLexer *lex, smsToken *tok) {
+	const char *data = lex->data;
+	int pos = lex->pos, end = lex->len;
+	while ( pos < end && (data[pos] == SPACE || data[pos] == TAB) ) pos++;	// skip blanks
+	if ( pos >= end ) { lex->pos = pos; return EOD; }						// end of data
+
+	if ( data[pos] == CARRIAGE_RETURN && pos + 1 < end && data[pos+1] == NEWLINE ) pos++;	// crlf
+	tok->ptr = data + pos;
+	if ( data[pos] == NEWLINE || data[pos] == CARRIAGE_RETURN ) {			// new line is a word
+		tok->len = 1;
+		lex->pos = pos + 1;
+		return data[pos];
+	}
+	int max = pos + BUFFER - 1;												// word is to long
+	if ( max > end ) max = end;
+	while ( pos + 8 <= max && !lexer_hasSeparator(data + pos) ) pos += 8;	// fast scan
+	while ( pos < max && !lexer_isSeparator(data[pos]) ) pos++;				// end of word
+	tok->len = pos - (tok->ptr - data);
+	lex->pos = pos;
+	return (tok->len == 1) ? tok->ptr[0] : UNKNOWN;						// return token
+}
+
+// compare word with string
+int lexer_isWord(smsToken *tok, const char *str) {
+	int size = strlen(str);
+	return tok->len == size && memcmp(tok->ptr, str, size) == 0;
+}
+
+// set view for a null terminated word
+void lexer_view(smsToken *tok, const char *word) {
+	tok->ptr = word;
+	tok->len = strlen(word);
+	return;
+}
+
+// copy word into null terminated buffer (size BUFFER) for the string parsers
+char *lexer_copy(smsToken *tok, char *buf) {
+	memcpy(buf, tok->ptr, tok->len);
+	buf[tok->len] = '\0';
+	return buf;
+}
+		
+// check if char alphanumeric
+int parser_isChar(BYTE c) {
+	// A = 65 ... Z = 90, // a = 97 ... z = 122
+	if(c > 64 && c <  91) return TRUE;
+	if(c > 96 && c < 123) return TRUE;
+	return FALSE;
+}
+
+// class of word by first char 
+const BYTE wordClass[256] = {
+	['@'] = WORD_MIDICC,
+	['A'] = WORD_CHORD, ['B'] = WORD_CHORD, ['C'] = WORD_CHORD, ['D'] = WORD_CHORD,
+	['E'] = WORD_CHORD, ['F'] = WORD_CHORD, ['G'] = WORD_CHORD,
+	['a'] = WORD_NOTE,  ['b'] = WORD_NOTE,  ['c'] = WORD_NOTE,  ['d'] = WORD_NOTE,
+	['e'] = WORD_NOTE,  ['f'] = WORD_NOTE,  ['g'] = WORD_NOTE,
+	['o'] = WORD_NOTE,  ['p'] = WORD_NOTE,  ['-'] = WORD_NOTE,  ['x'] = WORD_NOTE,
+	['0'] = WORD_NOTE,  ['1'] = WORD_NOTE,  ['2'] = WORD_NOTE,  ['3'] = WORD_NOTE,
+	['4'] = WORD_NOTE,  ['5'] = WORD_NOTE,  ['6'] = WORD_NOTE,  ['7'] = WORD_NOTE,
+	['8'] = WORD_NOTE,  ['9'] = WORD_NOTE,
+};
+
+// classify word of dynamic command, only the parser of class is used
+int parser_classify(char *word) {
+	if ( word[0] == 'b' ) {												// bpm= and bar= 
+		if ( word[1] == 'p' && word[2] == 'm' && (word[3] == '\0' || word[3] == '=') ) return WORD_BPM;
+		if ( word[1] == 'a' && word[2] == 'r' && (word[3] == '\0' || word[3] == '=') ) return WORD_BAR;
+	}
+	return wordClass[(BYTE)word[0]];
+}
+
+// get ticks of note duration, table is computed once for ppqn
+int parser_ticks(smsCtx *ctx, int ppqn, int dur, int dot) {
+	if ( ctx->ticks.ppqn != ppqn ) {
+		for ( int d = 1; d <= DURATION_MAX; d++ ) {
+			ctx->ticks.dur[d][0] = ppqn * 4 / d;
+			ctx->ticks.dur[d][1] = ctx->ticks.dur[d][0] + ctx->ticks.dur[d][0] / 2;	// dotted +50%
+		}
+		ctx->ticks.ppqn = ppqn;
+	}
+	return ctx->ticks.dur[dur][dot];
+}
+
+// get number from start of string, return count of size in char
+int parser_getNumber(char *p, int *value) {
+	if (strcmp(p, "EMPTY")  == 0) {
+		*value = EMPTY;
+		return strlen(p);
+	}
+	int v = p[0]; int count = 0;
+	*value = 0;
+	while( v-48 >=0 &&  v-48 <= 9) {
+		*value = *value * 10 + (v-48);
+		p++; count++;
+		v = p[0];
+	}
+	return count;	
+}
+
+// check repeater command 
+int parser_isRepeater(char *word, int *value) {
+	int v=-1;
+	if ( word[0] != '*' )				return ERR_DEF_PARAMETER;
+	int res = sscanf(word, "*%d", &v);
+	if ( res !=1 ) 						return ERR_DEF_PARAMETER;
+	*value = v;
+	return ERR_NOERROR;
 }
 
 // check dynamic parameter bpm and get value 
 int parser_isBPM(char *word, int *value) {
-	char *par = (char*)calloc(16, sizeof(char));	// initialize pointer for buffer with \0
+	char par[16] = "";
 	int v   = -1, err;
 	int res = sscanf(word, "%15[^=]=%d", par, &v);
 	if(res  == 0) 									return ERR_DEF_PARAMETER;
@@ -905,7 +2451,7 @@ int parser_isBPM(char *word, int *value) {
 
 // check dynamic parameter bar and get value 
 int parser_isBAR(char *word, int*value) {
-	char *par = (char*)calloc(16, sizeof(char));	// initialize pointer for buffer with \0
+	char par[16] = "";
 	int v   =-1, v2 = -1, err;
 	int res = sscanf(word, "%15[^=]=%d/%d", par, &v, &v2); 
 	if ( res == 0 )									return ERR_DEF_PARAMETER;
@@ -926,10 +2472,18 @@ int parser_isBAR(char *word, int*value) {
 //				s		pointer of given structure to merge parameter value
 //
 int parser_isParameter(char *word, int cmdType, void *s) {
-	char *par = (char*)calloc(16, sizeof(char));	// initialize pointer for buffer with \0
+	char par[16] = "";
 	int v=-1, v2=-1, value, err;
 	int res = sscanf(word, "%15[^=]=%d/%d", par, &v, &v2); 
 	
+	// value as built-in name of gm program or gm drum key (prg=Violin, key=ClosedHiHat)
+	char *name = strchr(word, '=');
+	if ( res == 1 && name && ((cmdType == INST && strcmp(par, "prg") == 0) || 
+							  (cmdType == DRUM && strcmp(par, "key") == 0)) ) {
+		int id = builtin_find(cmdType, name + 1, strlen(name + 1));
+		if ( id != EMPTY_ID ) { v = builtin[id].value; res = 2; }
+	}
+	
 	// proof is valid parameter for header	
 	if ( cmdType == HEADER) {
 		smsHeader *sms = s;
@@ -1004,7 +2558,7 @@ int parser_isParameter(char *word, int cmdType, void *s) {
 //              or @cc  =value,            @7=100
 int parser_isMidiCC(char *word, int *cc, int *val) {	
 	// midi_cc name and value
-	char *p = (char*)calloc(16, sizeof(char));					// initialize pointer for buffer with \0
+	char  p[16] = "";
 	int   v = -1;
 	if (sscanf(word, "@%15[^=]=%d", p, &v) < 2) 				return ERR_NO_COMMAND;
 	// check value
@@ -1017,306 +2571,1796 @@ int parser_isMidiCC(char *word, int *cc, int *val) {
 			*cc = ctrl;
 			return ERR_NOERROR;
 	}
-	// check is midi_cc name a defined standard midi_cc
-	if (strcmp(p, "vol")  == 0) 	{ *cc =    7; return ERR_NOERROR; }
-	if (strcmp(p, "bal")  == 0) 	{ *cc =    8; return ERR_NOERROR; }
-	if (strcmp(p, "pan")  == 0) 	{ *cc =   10; return ERR_NOERROR; }
-	if (strcmp(p, "dly")  == 0) 	{ *cc =   91; return ERR_NOERROR; }
+	// check is midi_cc name a built-in midi_cc name
+	int id = builtin_find(PARAMETER, p, strlen(p));
+	if ( id == EMPTY_ID )										return ERR_MCC_PARAMETER;
+	*cc = builtin[id].value;
 	return ERR_NOERROR;
 }
 
-// check is valid note
-int parser_isNote(char *data, smsNote *n, int type ) {
-	int value = 0, size = 0, flgHold = FALSE;
-	// check is valid note symbol for inst 
-	if (type == INST) {
-		switch (data[0]) {
-			case '-':
-			case 'o':
-			case 'p':	n->key = PAUSE; break;
-			case 'c':	n->key =  0; 	break;
-			case 'd':	n->key =  2;	break;
-			case 'e':	n->key =  4; 	break;
-			case 'f':	n->key =  5; 	break;
-			case 'g':	n->key =  7; 	break;
-			case 'a':	n->key =  9; 	break;
-			case 'b':	n->key = 11; 	break;
-			default: 	return ERR_NO_COMMAND;
-		}
-		data++;
+// decode note word into patch, independent of last note properties
+int parser_decodeNote(char *data, smsNotePatch *p, int type ) {
+	int value = 0, size = 0;
+	p->oct		= EMPTY;
+	p->octMove	= 0;
+	p->octUp	= -100;					// no octave up
+	p->octDown	=  100;					// no octave down
+	p->dur		= EMPTY;
+	p->vol		= EMPTY;
+	p->hold		= FALSE;
+	// check is valid note symbol for inst 
+	if (type == INST) {
+		switch (data[0]) {
+			case '-':
+			case 'o':
+			case 'p':	p->key = PAUSE; break;
+			case 'c':	p->key =  0; 	break;
+			case 'd':	p->key =  2;	break;
+			case 'e':	p->key =  4; 	break;
+			case 'f':	p->key =  5; 	break;
+			case 'g':	p->key =  7; 	break;
+			case 'a':	p->key =  9; 	break;
+			case 'b':	p->key = 11; 	break;
+			default: 	return ERR_NO_COMMAND;
+		}
+		data++;
+	}
+	// proof max of chord note value(24) / tab offset value (24)
+	if( type == BASENOTE || type == ARP) {
+		size = parser_getNumber(data, &value);
+		if(size) {
+			if ( value > NOTE_MAX_OFFSET ) 								return ERR_NOTE_OFFSET; 
+			p->key = value;
+			data  += size;
+		} else {
+			if(data[0] != 'p' && data[0] != 'o' && data[0] != '-')		return ERR_NO_COMMAND;
+			p->key = PAUSE;
+			data++;
+		}
+	}
+	// check is valid drum symbol
+	if ( type == DRUM ) {
+		if(data[0] == 'p' || data[0] == '-') data[0] = PAUSE;
+		if(data[0] != BEAT && data[0] != PAUSE ) return ERR_NO_COMMAND; 
+		p->key = data[0];
+		data++;
+	}
+
+	p->hft 	=   0;
+	p->dot	=	0;
+	
+	//check absolute octave a3>+/16.!46
+	if(type != ARP && type != BASENOTE) {
+		size = parser_getNumber(data, &value);
+		if(size) {
+			if (value > 10 ) 										return ERR_OCTAVE;
+			p->oct = value;
+			data += size;
+		}
+	}
+
+	// check qualifier
+	while(strlen(data)) {
+		switch (data[0]) {
+			case HALFTONE_UP:
+			case HALFTON_PLUS:
+				if(type == ARP)										return ERR_ARP_SYMBOL;
+				if(type == DRUM)									return ERR_DRUM_SYMBOL;	
+				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
+				p->hft = p->hft + 1;
+				++data;
+				break;	
+			case HALFTONE_MINUS:
+				if(type == ARP)										return ERR_ARP_SYMBOL;	
+				if(type == DRUM)									return ERR_DRUM_SYMBOL;
+				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
+				p->hft = p->hft - 1;
+				++data;
+				break;				
+			case OCTAVE_UP:
+				if(type == DRUM)									return ERR_DRUM_SYMBOL;
+				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
+				p->octMove = p->octMove + 1;
+				if(p->octUp < p->octMove) p->octUp = p->octMove;
+				++data; 
+				break;
+			case OCTAVE_DOWN:
+				if(type == DRUM)									return ERR_DRUM_SYMBOL;
+				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
+				p->octMove = p->octMove - 1;
+				if(p->octDown > p->octMove) p->octDown = p->octMove;
+				++data;
+				break;
+			case DURATION_DOT:
+				if(p->dot)											return ERR_DURATION_DOT;
+				p->dot = 1;
+				++data;
+				break;
+			case DURATION:
+				size = parser_getNumber(++data, &value);
+				if(!size) 											return ERR_DURATION;
+				if( value !=  1 && value !=  2 &&  
+					value !=  4 && value !=  8 && 
+					value != 16 && value != 32 &&
+					value != 64 ) 									return ERR_DURATION;
+				p->dur = value;
+				p->dot = 0;
+				data += size;
+				break;
+			case VOLUME:
+				size = parser_getNumber(++data, &value);
+				if(!size) 											return ERR_VOLUME;
+				if (value > 127 ) 									return ERR_VOLUME;
+				p->vol = value;
+				data += size;
+				break;
+			case HOLD:
+				if(data[1]  != '\0')								return ERR_HOLD_NOT_LAST;
+				p->hold = TRUE;
+				++data;
+				break;
+			default: 
+				return ERR_QUALIFIER_SYMBOL;
+		}	
+	}
+	return 	ERR_NOERROR;
+}
+
+// apply decoded note to last note properties, 
+// octave range is checked before a later error of word (order of parsing)
+int parser_applyNote(smsNotePatch *p, int err, smsNote *n, int type ) {
+	if ( err == ERR_NO_COMMAND ) 									return err;
+	int oct = ( p->oct != EMPTY ) ? p->oct : n->oct;
+	if ( type == INST && (oct + p->octUp > 10 || oct + p->octDown < 1) ) return ERR_OCTAVE;
+	if ( err ) 														return err;
+	n->key	= p->key;
+	n->hft	= p->hft;
+	n->dot	= p->dot;
+	n->oct	= oct + p->octMove;
+	if ( p->dur != EMPTY ) n->dur = p->dur;
+	if ( p->vol != EMPTY ) n->vol = p->vol;
+	n->hold	= ( p->hold ) ? n->key : EMPTY;
+	return ERR_NOERROR;
+}
+
+// check is valid note, decoded words are cached
+int parser_isNote(smsCtx *ctx, char *data, smsNote *n, int type ) {
+	int   len  = strlen(data);
+	DWORD hash = sym_hash(data, len) ^ type;
+	int   id   = memo_find(ctx, data, len, type, hash);
+	if ( id != EMPTY_ID ) {
+		ctx->memo.hits++;
+	} else {
+		ctx->memo.misses++;
+		id = memo_add(ctx, data, len, type, hash);
+		ctx->memo.ent[id].err = parser_decodeNote(data, &ctx->memo.ent[id].note, type);
+	}
+	return parser_applyNote(&ctx->memo.ent[id].note, ctx->memo.ent[id].err, n, type);
+}
+
+// check is valid base note, e.g. a5#:
+int parser_isBaseNote(char *data) {
+	int bs = EMPTY, pos = 0, oct = 0; 
+	int strSize  = strlen(data);
+	if(strSize < 2)	return EMPTY;
+
+	// check is valid note symbol 
+	switch (data[0]) {
+		case 'c':	bs =    0; 		break;
+		case 'd':	bs =    2;		break;
+		case 'e':	bs =    4; 		break;
+		case 'f':	bs =    5; 		break;
+		case 'g':	bs =    7; 		break;
+		case 'a':	bs =    9; 		break;
+		case 'b':	bs =   11; 		break;
+		default: 	return EMPTY; 	break;
+	}
+	data++; pos++;
+	
+	//check absolute octave
+	int size = parser_getNumber(data, &oct);
+	if(oct > 10) 									return EMPTY;
+	data += size; pos += size;
+	if(pos >= strSize) 								return EMPTY;
+	
+	//check halftone sign '#'
+	if(data[0] == HALFTONE_UP) { bs++; data++, pos++; }
+	if(pos >= strSize) 								return EMPTY;
+	
+	//check final sign ':'
+	if(data[0] != BASENOTE) 						return EMPTY;
+	if(++pos != strSize)							return ERR_BASENOTE;
+
+	return bs + (oct * 12);
+}
+
+// decode word as key chord and arp
+int parser_decodeChord(smsCtx *ctx, char *word, smsChordNote *cNote) {
+	int type = UNKNOWN;
+	char chord[16] = "", a[BUFFER] = "";				// subsegments chord and arp in word
+	char *c  = chord;
+	int res  = sscanf(word, "%15[^~]~%254s", c, a);
+	if ( res < 1 ) 									return ERR_NO_COMMAND;	// no key
+
+	switch (c[0]) {										// check main key
+		case 'C':	cNote->key =  0; break;
+		case 'D':	cNote->key =  2; break;
+		case 'E':	cNote->key =  4; break;
+		case 'F':	cNote->key =  5; break;
+		case 'G':	cNote->key =  7; break;
+		case 'A':	cNote->key =  9; break;
+		case 'B':	cNote->key = 11; break;
+		default :   return ERR_NO_COMMAND;
+	}
+	c++;
+	cNote->hft = FALSE;
+	if (c[0]==HALFTONE_UP || c[0]==HALFTON_PLUS) {cNote->hft = TRUE; c++;};	// check halftone
+	if ( !strlen(c) ) 								return ERR_KEYCHORD;	// no given key chord 	
+	int id = sym_find(ctx, c, strlen(c), &type);									// search user chord
+	if ( id != EMPTY_ID && type == CHORD ) {
+		cNote->chord = ((smsChord*)sym_object(ctx, id))->keys;
+	} else {																// search built-in chord
+		id = builtin_find(CHORD, c, strlen(c));
+		if ( id == EMPTY_ID ) 						return ERR_KEYCHORD;	// wrong key chord
+		cNote->chord = builtin[id].keys;
+	}
+
+	cNote->arp = NULL;
+	if ( strlen(a) ) {															// check arpreggio
+		id = sym_find(ctx, a, strlen(a), &type);
+		if ( id == EMPTY_ID || type != ARP )			return ERR_ARP;			// word as arp macro not found
+		cNote->arp = (smsMacro*)sym_object(ctx, id);
+	}
+	
+	return ERR_NOERROR;
+}
+
+// check word is valid chord type, decoded words are cached until next definition
+int parser_isChord(smsCtx *ctx, char *word, smsChordNote *cNote) {
+	int   len  = strlen(word);
+	DWORD hash = sym_hash(word, len) ^ CHORD;
+	int   id   = memo_find(ctx, word, len, CHORD, hash);
+	if ( id != EMPTY_ID && ctx->memo.ent[id].syms == ctx->symtab.cnt ) {
+		ctx->memo.hits++;
+	} else {
+		ctx->memo.misses++;
+		if ( id == EMPTY_ID ) id = memo_add(ctx, word, len, CHORD, hash);
+		ctx->memo.ent[id].syms = ctx->symtab.cnt;
+		ctx->memo.ent[id].err  = parser_decodeChord(ctx, word, &ctx->memo.ent[id].cnote);
+	}
+	smsMemoEntry *e = &ctx->memo.ent[id];
+	if ( e->err ) 									return e->err;
+	cNote->key	 = e->cnote.key;
+	if ( e->cnote.hft ) cNote->hft = 1;
+	cNote->chord = e->cnote.chord;
+	cNote->arp	 = e->cnote.arp;
+	return ERR_NOERROR;
+}
+
+// compile word list of arp into steps (durations in ticks for ppqn), 
+// an invalid word is the last step and keeps the error
+void parser_compileArp(smsCtx *ctx, smsMacro *arp, int ppqn) {
+	char word[BUFFER];
+	smsNote n = { .key = 0, .hft = 0, .oct = 0, .dur = DEFAULT_DURATION, 
+				  .hold = EMPTY, .dot = 0, .vol = DEFAULT_VOLUME };
+	if ( arp->size + 1 > arp->stepMax ) {
+		arp->stepMax  = arp->size + 1;
+		arp->step 	  = (smsArpStep*)sms_realloc(ctx, arp->step, arp->stepMax * sizeof(smsArpStep));
+	}
+	arp->steps	  = 0;
+	arp->stepPpqn = ppqn;
+	for ( int w = 0; w < arp->size; w++ ) {
+		smsArpStep *step = &arp->step[arp->steps++];
+		smsToken   *tok  = &arp->list[w];
+		memset(step, 0, sizeof(smsArpStep));
+		if ( tok->len == 1 && ( tok->ptr[0] == TIME_GROUP_START || 
+								tok->ptr[0] == TIME_GROUP_END   || 
+								tok->ptr[0] == BARLINE ) ) {
+			step->type = tok->ptr[0];
+			continue;
+		}
+		int err = parser_isNote(ctx, lexer_copy(tok, word), &n, ARP);
+		int oct = CHORD_OCTAVE + n.oct;
+		if ( !err && ( oct < 1 || oct > 10 ) ) 					err = ERR_OCTAVE;
+		if ( !err && n.key != PAUSE && n.key >= CHORD_KEYS )	err = ERR_ARP_OFFSET;
+		if ( err ) {
+			step->type = UNKNOWN;
+			step->err  = err;
+			break;
+		}
+		step->type = ( n.key == PAUSE ) ? PAUSE : NOTE;
+		step->key  = n.key;
+		step->vol  = n.vol;
+		step->oct  = oct;
+		step->dur  = parser_ticks(ctx, ppqn, n.dur, n.dot);
+	}
+	return;
+}
+
+/***************************************************************************
+ * macro event blocks
+ ***************************************************************************/
+
+// A macro is compiled once into an event block with times relative to its start.
+// Later invocations with the same entry state replay the block time-shifted and
+// set the exit state. The entry state covers only tracks and keys the macro uses.
+
+// move song times of state by offset (relative <-> absolute)
+void state_move(smsState *st, int offset) {
+	st->sngTime += offset;
+	if ( st->blkTimeStart != TIME_OFF ) st->blkTimeStart += offset;
+	if ( st->blkTimeEnd   != TIME_OFF ) st->blkTimeEnd   += offset;
+	if ( st->grpTimeStart != TIME_OFF ) st->grpTimeStart += offset;
+	if ( st->grpTimeEnd   != TIME_OFF ) st->grpTimeEnd   += offset;
+	return;
+}
+
+// get state of track
+void state_getTrk(smsTrkState *ts, smsTrack *trk) {
+	ts->trk  = trk;
+	ts->note = *trk->note;
+	ts->chft = trk->cnote->hft;
+	ts->chn  = trk->chn;
+	ts->bnk  = trk->bnk;
+	ts->prg  = trk->prg;
+	return;
+}
+
+// compare track with state (only properties read before set by a note)
+int state_isTrk(smsTrkState *ts) {
+	smsTrack *trk = ts->trk;
+	return trk->note->oct  == ts->note.oct  && trk->note->dur  == ts->note.dur  &&
+		   trk->note->vol  == ts->note.vol  && trk->note->hold == ts->note.hold &&
+		   trk->cnote->hft == ts->chft      && trk->chn == ts->chn && 
+		   trk->bnk        == ts->bnk       && trk->prg == ts->prg;
+}
+
+// begin compiling macro into new block inside compiling block (parent), NULL if macro has enough blocks
+smsBlock *block_begin(smsCtx *ctx, smsMacro *mac, smsState *st, smsBlock *parent, int evtId, int cntWORD) {
+	if ( mac->variants >= MACRO_VARIANTS ) return NULL;
+	smsBlock *blk = block_new(ctx);
+		blk->syms		= ctx->symtab.cnt;
+		blk->in			= *st;
+		blk->parent		= parent;
+		blk->entryTrk	= st->currentTrk;
+		blk->entryDKey	= st->currentDKey;
+		blk->mark		= ctx->events.cnt;
+		blk->markTempo	= ctx->events.tempos;
+		blk->markRef	= ctx->events.refs;
+		blk->start		= st->sngTime;
+		blk->evtId		= evtId;
+		blk->cntWORD	= cntWORD;
+		blk->cacheable	= TRUE;
+		blk->serial		= ctx->blockSerial++;
+		blk->in.currentTrk  = NULL;
+		blk->in.currentDKey = NULL;
+		state_move(&blk->in, -blk->start);
+	return blk;
+}
+
+// add used track with its entry state
+void block_addTrk(smsCtx *ctx, smsBlock *blk, smsTrack *trk) {
+	for ( int i = 0; i < blk->trks; i++ ) if ( blk->trkIn[i].trk == trk ) return;
+	if ( blk->trks == blk->trksMax ) {
+		blk->trksMax = ( blk->trksMax ) ? blk->trksMax * 2 : 4;
+		blk->trkIn   = (smsTrkState*)sms_realloc(ctx, blk->trkIn,  blk->trksMax * sizeof(smsTrkState));
+		blk->trkOut  = (smsTrkState*)sms_realloc(ctx, blk->trkOut, blk->trksMax * sizeof(smsTrkState));
+	}
+	state_getTrk(&blk->trkIn[blk->trks++], trk);
+	return;
+}
+
+// the following uses are marked in block and all enclosing blocks in compiling
+
+// track is used in block
+void block_useTrk(smsCtx *ctx, smsBlock *blk, smsTrack *trk) {
+	for ( ; blk; blk = blk->parent ) block_addTrk(ctx, blk, trk);
+	return;
+}
+
+// block switches to track (and drum key)
+void block_switch(smsCtx *ctx, smsBlock *blk, smsTrack *trk, smsDrumKey *dkey) {
+	for ( ; blk; blk = blk->parent ) {
+		block_addTrk(ctx, blk, trk);
+		blk->out.currentTrk = trk;
+		if ( dkey ) blk->out.currentDKey = dkey;
+	}
+	return;
+}
+
+// block uses current track of entry before any track switch
+void block_useEntryTrk(smsCtx *ctx, smsBlock *blk) {
+	for ( ; blk; blk = blk->parent ) {
+		if ( blk->out.currentTrk || blk->in.currentTrk ) continue;
+		blk->in.currentTrk = blk->entryTrk;
+		block_addTrk(ctx, blk, blk->entryTrk);
+	}
+	return;
+}
+
+// block uses current drum key of entry before any drum key switch
+void block_useEntryDKey(smsBlock *blk) {
+	for ( ; blk; blk = blk->parent ) 
+		if ( !blk->out.currentDKey ) blk->in.currentDKey = blk->entryDKey;
+	return;
+}
+
+// block contains definitions, can't be replayed
+void block_noCache(smsBlock *blk) {
+	for ( ; blk; blk = blk->parent ) blk->cacheable = FALSE;
+	return;
+}
+
+// nested block is replayed inside block, it uses what the nested block uses
+void block_useBlock(smsCtx *ctx, smsBlock *blk, smsBlock *nested) {
+	if ( nested->in.currentTrk )  block_useEntryTrk(ctx, blk);
+	if ( nested->in.currentDKey ) block_useEntryDKey(blk);
+	for ( int i = 0; i < nested->trks; i++ ) block_useTrk(ctx, blk, nested->trkIn[i].trk);
+	if ( nested->out.currentTrk ) block_switch(ctx, blk, nested->out.currentTrk, nested->out.currentDKey);
+	return;
+}
+
+// end compiling macro, keep block for replay and replace its events with a reference
+void block_end(smsCtx *ctx, smsMacro *mac, smsBlock *blk, smsState *st, smsHeader *sms, int cntWORD) {
+	if ( !blk->cacheable ) { block_free(ctx, blk); return; }
+	// exit state
+	smsTrack   *trk  = ( blk->out.currentTrk )  ? st->currentTrk  : NULL;
+	smsDrumKey *dkey = ( blk->out.currentDKey ) ? st->currentDKey : NULL;
+	blk->out 			 = *st;
+	blk->out.currentTrk  = trk;
+	blk->out.currentDKey = dkey;
+	state_move(&blk->out, -blk->start);
+	for ( int i = 0; i < blk->trks; i++ ) state_getTrk(&blk->trkOut[i], blk->trkIn[i].trk);
+	// move events of block into block, nested blocks stay references
+	smsEvents *e = &ctx->events;
+	for ( int i = blk->mark; i < e->cnt; i++ ) 
+		evt_push(ctx, &blk->evt, e->trk[i], e->evtId[i] - blk->evtId, e->time[i] - blk->start, 
+				 e->status[i], e->data1[i], e->data2[i]);
+	for ( int i = blk->markTempo; i < e->tempos; i++ ) 
+		evt_pushTempo(ctx, &blk->evt, e->tempo[i].evtId - blk->evtId, e->tempo[i].bpm);
+	for ( int i = blk->markRef; i < e->refs; i++ ) 
+		evt_pushRef(ctx, &blk->evt, e->ref[i].blk, e->ref[i].time - blk->start, e->ref[i].evtId - blk->evtId);
+	e->cnt	  = blk->mark;
+	e->tempos = blk->markTempo;
+	e->refs   = blk->markRef;
+	blk->size  = sms->evts - blk->evtId;
+	blk->words = cntWORD - blk->cntWORD;
+	blk->next  = mac->blocks;
+	mac->blocks = blk;
+	mac->variants++;
+	newSmsBlockEvent(ctx, blk, blk->evtId, blk->start);
+	return;
+}
+
+// block can be replayed at state (relative to song time)
+int block_match(smsBlock *blk, smsState *rel) {
+	smsState *in = &blk->in;
+	if ( in->bar != rel->bar || in->ppqn != rel->ppqn || in->barTime != rel->barTime ) 	  return FALSE;
+	if ( in->P_COMMENT != rel->P_COMMENT || in->currentBaseNote != rel->currentBaseNote ) return FALSE;
+	if ( in->P_TIMEBLOCK != rel->P_TIMEBLOCK || in->P_TIMEGROUP != rel->P_TIMEGROUP ) 	  return FALSE;
+	if ( rel->P_TIMEBLOCK == PASSING && 
+		( in->blkTimeStart != rel->blkTimeStart || in->blkTimeEnd != rel->blkTimeEnd ) ) return FALSE;
+	if ( rel->P_TIMEGROUP == PASSING && 
+		( in->grpTimeStart != rel->grpTimeStart || in->grpTimeEnd != rel->grpTimeEnd || 
+		  in->grpTimeBar   != rel->grpTimeBar ) ) 										  return FALSE;
+	if ( in->currentTrk  && in->currentTrk  != rel->currentTrk )  						  return FALSE;
+	if ( in->currentDKey && in->currentDKey != rel->currentDKey ) 						  return FALSE;
+	for ( int i = 0; i < blk->trks; i++ ) if ( !state_isTrk(&blk->trkIn[i]) ) 			  return FALSE;
+	return TRUE;
+}
+
+// find compiled block of macro for current state
+smsBlock *block_find(smsCtx *ctx, smsMacro *mac, smsState *st) {
+	// blocks compiled before new definitions are not used anymore, 
+	// but kept as they are referenced by events
+	if ( mac->blocks && mac->blocks->syms != ctx->symtab.cnt ) mac->variants = 0;
+	smsState rel = *st;
+	state_move(&rel, -st->sngTime);
+	for ( smsBlock *blk = mac->blocks; blk && blk->syms == ctx->symtab.cnt; blk = blk->next ) 
+		if ( block_match(blk, &rel) ) return blk;
+	return NULL;
+}
+
+// replay block at current state: reference to block and exit state
+void block_replay(smsCtx *ctx, smsBlock *blk, smsState *st, smsHeader *sms) {
+	int start = st->sngTime;
+	newSmsBlockEvent(ctx, blk, sms->evts, start);
+	sms->evts += blk->size;
+	for ( int i = 0; i < blk->trks; i++ ) {
+		smsTrkState *ts = &blk->trkOut[i];
+		*ts->trk->note    = ts->note;
+		ts->trk->cnote->hft = ts->chft;
+	}
+	smsTrack   *trk  = st->currentTrk;
+	smsDrumKey *dkey = st->currentDKey;
+	*st = blk->out;
+	state_move(st, start);
+	if ( !st->currentTrk )  st->currentTrk  = trk;
+	if ( !st->currentDKey ) st->currentDKey = dkey;
+	return;
+}
+
+// materialize midi events at time and event number into track buckets (nested blocks recursive),
+// bucket of track is found by its symbol id (slot), tempo changes are collected for the song
+void block_emit(smsCtx *ctx, smsEvents *bucket, int *slot, smsEvents *tempo, smsEvents *e, int time, int evtId) {
+	for ( int i = 0; i < e->cnt; i++ ) 
+		evt_push(ctx, &bucket[slot[e->trk[i]]], e->trk[i], e->evtId[i] + evtId, e->time[i] + time, 
+				 e->status[i], e->data1[i], e->data2[i]);
+	for ( int i = 0; i < e->tempos; i++ ) 
+		evt_pushTempo(ctx, tempo, e->tempo[i].evtId + evtId, e->tempo[i].bpm);
+	for ( int i = 0; i < e->refs; i++ ) 
+		block_emit(ctx, bucket, slot, tempo, &e->ref[i].blk->evt, e->ref[i].time + time, e->ref[i].evtId + evtId);
+	return;
+}
+
+// expand events at time and event number into one event store (nested blocks recursive)
+void block_flatten(smsCtx *ctx, smsEvents *dst, smsEvents *e, int time, int evtId) {
+	for ( int i = 0; i < e->cnt; i++ ) 
+		evt_push(ctx, dst, e->trk[i], e->evtId[i] + evtId, e->time[i] + time, e->status[i], e->data1[i], e->data2[i]);
+	for ( int i = 0; i < e->tempos; i++ ) 
+		evt_pushTempo(ctx, dst, e->tempo[i].evtId + evtId, e->tempo[i].bpm);
+	for ( int i = 0; i < e->refs; i++ ) 
+		block_flatten(ctx, dst, &e->ref[i].blk->evt, e->ref[i].time + time, e->ref[i].evtId + evtId);
+	return;
+}
+
+/***************************************************************************
+ * worker threads
+ ***************************************************************************/
+
+#ifdef _WIN32
+typedef HANDLE					smsThread;
+typedef LPTHREAD_START_ROUTINE	smsThreadFunc;
+#define THREAD_RESULT			DWORD WINAPI
+#else
+typedef pthread_t				smsThread;
+typedef void *(*smsThreadFunc)(void *);
+#define THREAD_RESULT			void *
+#endif
+
+// get number of processors
+int thread_cpus() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+	return ( n > 0 ) ? n : 1;
+#endif
+}
+
+// start thread, returns TRUE if started
+int thread_start(smsThread *thread, smsThreadFunc func, void *arg) {
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+	return *thread != NULL;
+#else
+	return pthread_create(thread, NULL, func, arg) == 0;
+#endif
+}
+
+// wait for end of thread
+void thread_join(smsThread thread) {
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+	return;
+}
+
+/***************************************************************************
+ * midi playback
+ ***************************************************************************/
+
+// The song is read in place from midi file data, its tracks are merged in time order
+// and ticks are converted to microsec with the tempo changes (FF 51). The producer
+// hands the events through a lock-free single producer / single consumer queue to 
+// the playback thread. It sleeps until the absolute deadline of each event, spins the
+// last PLAY_SPIN microsec and passes the event to the sink (raw midi byte stream to a 
+// file descriptor or a callback). The lateness of each event is kept in a histogram.
+// While the queue is empty the playback thread blocks until the producer signals.
+
+#ifdef _WIN32
+#define ATOMIC_GET(p)		InterlockedCompareExchange((volatile LONG*)(p), 0, 0)
+#define ATOMIC_SET(p, v)	InterlockedExchange((volatile LONG*)(p), (v))
+#define ATOMIC_CAS(p, o, v)	(InterlockedCompareExchange((volatile LONG*)(p), (v), (o)) == (o))
+#else
+#define ATOMIC_GET(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_SET(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ATOMIC_CAS(p, o, v)	__atomic_compare_exchange_n((p), &(int){ (o) }, (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#endif
+
+typedef void (*smsSinkFunc)(void *arg, BYTE status, const char *data, int len);
+
+typedef struct SMS_SINK {
+	smsSinkFunc	 send;				// called by playback thread at time of event
+	void		*arg;				// argument of send (e.g. file descriptor)
+}smsSink;
+
+typedef struct SMS_PLAY_EVENT {
+	long long	 usec;				// deadline in microsec after start of playback
+	BYTE		 status;			// status byte, 0: end of playback
+	BYTE		 msg[2];			// data bytes of channel message
+	const char	*data;				// sysex data in place, NULL: data bytes in msg
+	int			 len;				// number of data bytes
+}smsPlayEvt;
+
+typedef struct SMS_PLAY_STAT {
+	int			 hist[PLAY_HIST];	// number of events per microsec of lateness (jitter)
+	int			 cnt;				// number of events
+	int			 over;				// number of events later than histogram
+	long long	 max;				// highest lateness in microsec
+	int			 realtime;			// TRUE: playback thread runs with real-time priority
+}smsPlayStat;
+
+typedef struct SMS_PLAYER {
+	smsSink		 sink;				// receiver of midi messages
+	smsPlayEvt	 queue[PLAY_QUEUE];	// ring buffer of events
+	int			 head;				// read position,  written by playback thread only
+	int			 tail;				// write position, written by producer only
+	long long	 start;				// monotonic clock at time 0 of playback
+	smsThread	 thread;			// playback thread
+	smsPlayStat	 stat;				// lateness of played events
+#ifdef _WIN32
+	HANDLE		 wake;				// set by producer after queuing events (auto reset)
+#else
+	pthread_mutex_t lock;			// lock of wake
+	pthread_cond_t	wake;			// signaled by producer after queuing events
+#endif
+}smsPlayer;
+
+typedef struct SMS_CHASE {
+	BYTE		 ctl[16][120];		// controller value + 1 of channel (0: not set), without mode messages
+	BYTE		 prg[16];			// program + 1 of channel (0: not set)
+	WORD		 bend[16];			// pitch bend + 1 of channel (0: not set)
+}smsChase;
+
+typedef struct SMS_SONG {
+	struct SMF	 smf;				// midi file data (in place)
+	struct MEVT	*evt;				// reader of each track
+	struct MEVT	**heap;				// min heap of next events (time, then track)
+	int			 cnt;				// number of tracks in heap
+	DWORD		 tick;				// time of last tempo change in ticks
+	double		 usec;				// time of last tempo change in microsec
+	double		 tempo;				// microsec per tick
+}smsSong;
+
+// monotonic clock in microsec
+long long clock_usec() {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if ( !freq.QuadPart ) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return now.QuadPart / freq.QuadPart * 1000000 + now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+// timer resolution of 1 ms for the process while playing (Windows default: 15.6 ms),
+// winmm is loaded at run time, so no import library is needed
+void clock_resolution(int fine) {
+#ifdef _WIN32
+	typedef UINT (WINAPI *periodFunc)(UINT);
+	HMODULE    winmm = LoadLibraryA("winmm.dll");
+	periodFunc f     = ( winmm ) ? (periodFunc)GetProcAddress(winmm, ( fine ) ? "timeBeginPeriod" : "timeEndPeriod") : NULL;
+	if ( f ) f(1);
+	if ( winmm ) FreeLibrary(winmm);					// stays loaded while period is set
+#else
+	(void)fine;											// nanosleep is exact enough
+#endif
+	return;
+}
+
+// sleep for microsec (polling, not exact)
+void clock_wait(int usec) {
+#ifdef _WIN32
+	Sleep((usec + 999) / 1000);							// at least one timer tick, no busy loop
+#else
+	struct timespec ts = { usec / 1000000, (usec % 1000000) * 1000L };
+	nanosleep(&ts, NULL);
+#endif
+	return;
+}
+
+// sleep until absolute deadline of monotonic clock, the last PLAY_SPIN microsec are 
+// spinning, so the wake up latency of the scheduler is not part of the deadline
+void clock_sleepUntil(long long usec) {
+	long long wake = usec - PLAY_SPIN;
+#ifdef _WIN32
+	long long now  = clock_usec();
+	if ( wake - now > 2000 ) Sleep((DWORD)((wake - now) / 1000 - 2));	// timer resolution 1 ms
+#else
+	struct timespec ts = { wake / 1000000, (wake % 1000000) * 1000L };
+	if ( wake > clock_usec() ) 
+		while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR );
+#endif
+	while ( clock_usec() < usec );
+	return;
+}
+
+// real-time priority for calling thread, returns FALSE if not permitted
+int thread_realtime() {
+#ifdef _WIN32
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+	struct sched_param sp = { 0 };
+	sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) == 0;
+#endif
+}
+
+// add lateness of event to histogram
+void jitter_add(smsPlayStat *j, long long late) {
+	if ( late < 0 ) late = 0;
+	if ( late < PLAY_HIST ) j->hist[late]++;
+	else                    j->over++;
+	if ( late > j->max ) j->max = late;
+	j->cnt++;
+	return;
+}
+
+// lateness in microsec not exceeded by p percent of the events
+long long jitter_percentile(smsPlayStat *j, double p) {
+	long long need = (long long)(j->cnt * p / 100.0 + 0.999999), sum = 0;
+	for ( int i = 0; i < PLAY_HIST; i++ ) {
+		sum += j->hist[i];
+		if ( sum >= need ) return i;
+	}
+	return j->max;
+}
+
+// sink: raw midi byte stream to file descriptor (file, fifo or midi device)
+void sink_write(void *arg, BYTE status, const char *data, int len) {
+	struct iovec iov[2] = { { &status, 1 }, { (char*)data, len } };
+	writeIOV((int)(intptr_t)arg, iov, 2);
+	return;
+}
+
+// playback thread: wait until queue is not empty, blocked until the producer signals
+void play_wait(smsPlayer *pl, int head) {
+#ifdef _WIN32
+	while ( head == ATOMIC_GET(&pl->tail) ) WaitForSingleObject(pl->wake, INFINITE);
+#else
+	pthread_mutex_lock(&pl->lock);
+	while ( head == ATOMIC_GET(&pl->tail) ) pthread_cond_wait(&pl->wake, &pl->lock);
+	pthread_mutex_unlock(&pl->lock);
+#endif
+	return;
+}
+
+// producer: wake playback thread after queuing an event
+void play_signal(smsPlayer *pl) {
+#ifdef _WIN32
+	SetEvent(pl->wake);
+#else
+	pthread_mutex_lock(&pl->lock);						// no lost wake up between check and wait
+	pthread_cond_signal(&pl->wake);
+	pthread_mutex_unlock(&pl->lock);
+#endif
+	return;
+}
+
+// playback thread: play events of queue at their deadline
+THREAD_RESULT play_worker(void *arg) {
+	smsPlayer *pl = arg;
+	pl->stat.realtime = thread_realtime();
+	int head = pl->head;
+	for ( ;; ) {
+		play_wait(pl, head);											// queue empty: no polling
+		smsPlayEvt evt = pl->queue[head & (PLAY_QUEUE - 1)];			// copy, slot is free again
+		ATOMIC_SET(&pl->head, ++head);
+		if ( !evt.status ) break;										// end of playback
+		long long deadline = pl->start + evt.usec;
+		clock_sleepUntil(deadline);
+		jitter_add(&pl->stat, clock_usec() - deadline);
+		pl->sink.send(pl->sink.arg, evt.status, ( evt.data ) ? evt.data : (char*)evt.msg, evt.len);
+	}
+	return 0;
+}
+
+// free player and its wake up
+void play_free(smsPlayer *pl) {
+#ifdef _WIN32
+	CloseHandle(pl->wake);
+#else
+	pthread_cond_destroy(&pl->wake);
+	pthread_mutex_destroy(&pl->lock);
+#endif
+	clock_resolution(FALSE);
+	free(pl);
+	return;
+}
+
+// start playback thread, time 0 of playback is PLAY_AHEAD from now, NULL if thread not started
+smsPlayer *play_open(smsSink sink) {
+	smsPlayer *pl = (smsPlayer*)calloc(1, sizeof(smsPlayer));
+	pl->sink  = sink;
+#ifdef _WIN32
+	pl->wake  = CreateEventA(NULL, FALSE, FALSE, NULL);
+#else
+	pthread_mutex_init(&pl->lock, NULL);
+	pthread_cond_init(&pl->wake, NULL);
+#endif
+	clock_resolution(TRUE);
+	pl->start = clock_usec() + PLAY_AHEAD;
+	if ( !thread_start(&pl->thread, play_worker, pl) ) { play_free(pl); return NULL; }
+	return pl;
+}
+
+// queue event for playback at time in microsec (events in time order), waits until 
+// event is at most PLAY_AHEAD before its time and the queue has space, channel messages
+// are copied, sysex data must stay valid until played
+void play_push(smsPlayer *pl, long long usec, BYTE status, const char *data, int len) {
+	long long ahead = pl->start + usec - PLAY_AHEAD - clock_usec();
+	if ( ahead > 0 ) clock_wait((int)( ( ahead < 1000000 ) ? ahead : 1000000 ));
+	while ( pl->start + usec - PLAY_AHEAD > clock_usec() ) clock_wait(PLAY_SPIN);
+	int tail = pl->tail;
+	while ( tail - ATOMIC_GET(&pl->head) >= PLAY_QUEUE ) clock_wait(PLAY_SPIN);	// queue full
+	smsPlayEvt *evt = &pl->queue[tail & (PLAY_QUEUE - 1)];
+	evt->usec   = usec;
+	evt->status = status;
+	evt->len    = len;
+	evt->data   = ( len > 2 ) ? data : NULL;
+	if ( len > 0 && len <= 2 ) memcpy(evt->msg, data, len);
+	ATOMIC_SET(&pl->tail, tail + 1);
+	play_signal(pl);
+	return;
+}
+
+// play all queued events, stop playback thread and free player, stat: lateness of events
+void play_close(smsPlayer *pl, smsPlayStat *stat) {
+	play_push(pl, 0, 0, NULL, 0);									// end of playback
+	thread_join(pl->thread);
+	if ( stat ) *stat = pl->stat;
+	play_free(pl);
+	return;
+}
+
+// open midi file data for playback (in place), returns FALSE if none midi file
+int song_open(smsSong *s, char *data, int len) {
+	memset(s, 0, sizeof(smsSong));
+	if ( !openSMF(&s->smf, data, len) ) return FALSE;
+	struct MEVT evt;
+	int max = 0;
+	while ( nextTRK(&s->smf, &evt) ) {
+		if ( !readEVT(&evt) ) continue;								// empty or invalid track
+		if ( s->cnt == max ) {
+			max    = ( max ) ? max * 2 : 16;
+			s->evt = (struct MEVT*)realloc(s->evt, max * sizeof(struct MEVT));
+		}
+		s->evt[s->cnt++] = evt;
+	}
+	s->heap = (struct MEVT**)malloc(s->cnt * sizeof(struct MEVT*) + 1);
+	for ( int i = 0; i < s->cnt; i++ ) s->heap[i] = &s->evt[i];
+	for ( int i = s->cnt / 2 - 1; i >= 0; i-- ) heap_down(s->heap, s->cnt, i);
+	WORD div = s->smf.hdr.ppqn;
+	if ( div & 0x8000 ) {											// smpte: frames and ticks per frame
+		int fps = 256 - (div >> 8), tpf = div & 0xFF;
+		s->tempo = ( fps && tpf ) ? 1000000.0 / (fps * tpf) : 0;
+	} else {
+		s->tempo = ( div ) ? 500000.0 / div : 0;					// default 120 bpm
+	}
+	return TRUE;
+}
+
+// time of tick in microsec, valid from last tempo change up to next event
+double song_usec(smsSong *s, DWORD tick) {
+	return s->usec + ((double)tick - s->tick) * s->tempo;
+}
+
+// get next event of song in time order and its time in microsec, returns FALSE at end of song
+int song_next(smsSong *s, struct MEVT *evt, double *usec) {
+	if ( !s->cnt ) return FALSE;
+	struct MEVT *e = s->heap[0];
+	*evt  = *e;
+	*usec = song_usec(s, e->trk.time);
+	if ( e->status == 0xFF && e->data[0] == 0x51 && !(s->smf.hdr.ppqn & 0x8000) ) {
+		DWORD len;
+		char *data = dataMTA(e, &len);
+		if ( len == 3 ) {											// tempo change
+			s->usec  = *usec;
+			s->tick  = e->trk.time;
+			s->tempo = (double)readVAL(data, 3) / s->smf.hdr.ppqn;
+		}
+	}
+	if ( !readEVT(e) ) s->heap[0] = s->heap[--s->cnt];				// track finished
+	if ( s->cnt ) heap_down(s->heap, s->cnt, 0);
+	return TRUE;
+}
+
+// skip events before tick, the last settings of channels (controller, program, pitch bend)
+// are kept in chase, so playback can start at tick with the sound of the song
+void song_seek(smsSong *s, DWORD tick, smsChase *c) {
+	struct MEVT evt;
+	double      usec;
+	memset(c, 0, sizeof(smsChase));
+	while ( s->cnt && s->heap[0]->trk.time < tick && song_next(s, &evt, &usec) ) {
+		BYTE chn = evt.status & 0x0F, *d = (BYTE*)evt.data;
+		switch ( evt.status & 0xF0 ) {
+			case 0xB0:	if ( d[0] < 120 ) c->ctl[chn][d[0]] = d[1] + 1;	break;
+			case 0xC0:	c->prg[chn]  = d[0] + 1;							break;
+			case 0xE0:	c->bend[chn] = (d[0] | d[1] << 7) + 1;				break;
+		}
+	}
+	return;
+}
+
+void song_close(smsSong *s) {
+	free(s->evt);
+	free(s->heap);
+	return;
+}
+
+// queue all notes off for all channels at time (microsec)
+void play_notesOff(smsPlayer *pl, long long usec) {
+	for ( int chn = 0; chn < 16; chn++ ) play_push(pl, usec, 0xB0 + chn, "\x7B\x00", 2);
+	return;
+}
+
+// queue settings of channels at time (microsec): controllers (bank first), program, pitch bend
+void play_chase(smsPlayer *pl, long long usec, smsChase *c) {
+	char d[2];
+	for ( int chn = 0; chn < 16; chn++ ) {
+		for ( int cc = 0; cc < 120; cc++ ) {
+			if ( !c->ctl[chn][cc] ) continue;
+			d[0] = cc; d[1] = c->ctl[chn][cc] - 1;
+			play_push(pl, usec, 0xB0 + chn, d, 2);
+		}
+		if ( c->prg[chn] ) 	{ d[0] = c->prg[chn] - 1; play_push(pl, usec, 0xC0 + chn, d, 1); }
+		if ( c->bend[chn] ) { 
+			d[0] = (c->bend[chn] - 1) & 0x7F; d[1] = (c->bend[chn] - 1) >> 7;
+			play_push(pl, usec, 0xE0 + chn, d, 2);
+		}
+	}
+	return;
+}
+
+// queue midi messages of midi file data for playback, starting at time offset (microsec),
+// meta events and sysex escapes (F7) are not played, returns FALSE if none midi file
+int play_song(smsPlayer *pl, char *data, int len, long long offset) {
+	smsSong     song;
+	struct MEVT evt;
+	double      usec;
+	if ( !song_open(&song, data, len) ) return FALSE;
+	while ( song_next(&song, &evt, &usec) ) {
+		if ( evt.status == 0xFF || evt.status == 0xF7 ) continue;
+		char *p = evt.data;
+		DWORD n = evt.len;
+		if ( evt.status == 0xF0 ) readVLQ(&p, evt.end, &n);			// sysex: data after length
+		play_push(pl, offset + (long long)usec, evt.status, p, n);
+	}
+	song_close(&song);
+	return TRUE;
+}
+
+/***************************************************************************
+ * compile cache (macro event blocks on disk)
+ ***************************************************************************/
+
+// Compiled event blocks of macros are kept in files of the cache directory, one file per key 
+// of macro. The key is the hash of the word list and of the definitions of all symbols whose 
+// names occur in the words, nested macros and arps with their keys (compiler build included), 
+// so every change of the macro or of a definition it may use gives a new key and a new file.
+// A file holds the compiled variants of the macro, each with entry state (tracks and drum keys
+// by name), exit state and events (nested blocks expanded). A variant is loaded if its entry 
+// state matches, like a block in memory (block_match). A variant already in the file is not
+// stored again and a file holds at most MACRO_VARIANTS variants, like a macro in memory.
+
+#define CACHE_MAGIC		0x434D5353				// "SMSC", start of variant
+#define CACHE_SEED		14695981039346656037ULL	// FNV-1a 64 bit
+#define CACHE_PRIME		1099511628211ULL
+#define CACHE_STATE		13						// int values of state (without pointers)
+#define CACHE_MAXSIZE	0x10000000				// max. size of variant, longer ones are not cached
+
+unsigned long long cache_hash(unsigned long long h, const void *data, int len) {
+	const BYTE *p = (const BYTE*)data;
+	for ( int i = 0; i < len; i++ ) h = (h ^ p[i]) * CACHE_PRIME;
+	return h;
+}
+
+// name occurs in word
+int cache_isIn(smsToken *tok, const char *name, int len) {
+	for ( int i = 0; i + len <= tok->len; i++ ) 
+		if ( memcmp(tok->ptr + i, name, len) == 0 ) return TRUE;
+	return FALSE;
+}
+
+// find symbols named in word list of macro (again after new definitions)
+void cache_deps(smsCtx *ctx, smsMacro *mac) {
+	if ( mac->deps && mac->depSyms == ctx->symtab.cnt ) return;
+	if ( ctx->symtab.cnt + 1 > mac->depMax ) {
+		mac->depMax = ctx->symtab.cnt + 1;
+		mac->deps   = (int*)sms_realloc(ctx, mac->deps, sizeof(int) * mac->depMax);
+	}
+	mac->depCnt  = 0;
+	mac->depSyms = ctx->symtab.cnt;
+	for ( int id = 0; id < ctx->symtab.cnt; id++ ) {
+		smsSymbol *sym = &ctx->symtab.sym[id];
+		for ( int w = 0; w < mac->size; w++ ) 
+			if ( cache_isIn(&mac->list[w], ctx->symtab.names + sym->name, sym->len) ) {
+				mac->deps[mac->depCnt++] = id;
+				break;
+			}
+	}
+	return;
+}
+
+// hash macro and its dependencies, each macro once (depth first)
+unsigned long long cache_keyMix(smsCtx *ctx, unsigned long long h, smsMacro *mac) {
+	mac->mark = ctx->cache.mark;
+	h = cache_hash(h, &mac->cmd, sizeof(int));
+	for ( int w = 0; w < mac->size; w++ ) {
+		h = cache_hash(h, mac->list[w].ptr, mac->list[w].len);
+		h = cache_hash(h, "", 1);								// word separator
+	}
+	cache_deps(ctx, mac);
+	for ( int i = 0; i < mac->depCnt; i++ ) {
+		smsSymbol *sym = &ctx->symtab.sym[mac->deps[i]];
+		h = cache_hash(h, &sym->type, 1);
+		h = cache_hash(h, ctx->symtab.names + sym->name, sym->len + 1);
+		switch ( sym->type ) {
+			case INST:	{	smsTrack *p = sym->obj;
+							int v[3] = { p->chn, p->bnk, p->prg };
+							h = cache_hash(h, v, sizeof(v));
+							break;
+						}
+			case DRUM:	h = cache_hash(h, &((smsDrumKey*)sym->obj)->key, sizeof(int));
+						break;
+			case CHORD:	h = cache_hash(h, ((smsChord*)sym->obj)->keys, CHORD_KEYS);
+						break;
+			case ARP:
+			case MACRO:	if ( ((smsMacro*)sym->obj)->mark != ctx->cache.mark ) h = cache_keyMix(ctx, h, sym->obj);
+						break;
+		}
+	}
+	return h;
+}
+
+// key of macro
+unsigned long long cache_key(smsCtx *ctx, smsMacro *mac) {
+	static const char build[] = SMSVERSION " " __DATE__ " " __TIME__;
+	ctx->cache.mark++;
+	return cache_keyMix(ctx, cache_hash(CACHE_SEED, build, sizeof(build)), mac);
+}
+
+// file name of key
+void cache_path(smsCtx *ctx, char *path, smsMacro *mac) {
+	snprintf(path, BUFFER, "%s/%016llx.smc", ctx->cache.dir, cache_key(ctx, mac));
+	return;
+}
+
+// file data of variant with size, memory is kept, NULL if not possible
+char *cache_buf(smsCtx *ctx, size_t size) {
+	smsCache *c = &ctx->cache;
+	if ( size > c->bufMax ) {
+		size_t max = ( c->bufMax ) ? c->bufMax : 4096;
+		while ( max < size ) max = ( max > size / 2 ) ? size : max * 2;	// doubling without overflow
+		char *buf = (char*)sms_realloc(ctx, c->buf, max);
+		if ( !buf ) return NULL;
+		c->buf    = buf;
+		c->bufMax = max;
+	}
+	return c->buf;
+}
+
+// append bytes to file data
+void cache_put(smsCtx *ctx, const void *data, int len) {
+	smsCache *c = &ctx->cache;
+	memcpy(cache_buf(ctx, (size_t)c->bufLen + len) + c->bufLen, data, len);
+	c->bufLen += len;
+	return;
+}
+
+// name of symbol as length and characters, length -1 if none
+void cache_putName(smsCtx *ctx, int id) {
+	int len = ( id == EMPTY_ID ) ? -1 : ctx->symtab.sym[id].len;
+	cache_put(ctx, &len, sizeof(int));
+	if ( len > 0 ) cache_put(ctx, ctx->symtab.names + ctx->symtab.sym[id].name, len);
+	return;
+}
+
+void cache_putState(smsCtx *ctx, smsState *st) {
+	int v[CACHE_STATE] = { st->bar, st->ppqn, st->sngTime, st->barTime, 
+						   st->P_TIMEBLOCK, st->blkTimeStart, st->blkTimeEnd, 
+						   st->P_TIMEGROUP, st->grpTimeStart, st->grpTimeEnd, st->grpTimeBar, 
+						   st->P_COMMENT, st->currentBaseNote };
+	cache_put(ctx, v, sizeof(v));
+	cache_putName(ctx, ( st->currentTrk )  ? st->currentTrk->id  : EMPTY_ID);
+	cache_putName(ctx, ( st->currentDKey ) ? st->currentDKey->id : EMPTY_ID);
+	return;
+}
+
+void cache_putTrk(smsCtx *ctx, smsTrkState *ts) {
+	int v[4] = { ts->chft, ts->chn, ts->bnk, ts->prg };
+	cache_put(ctx, &ts->note, sizeof(smsNote));
+	cache_put(ctx, v, sizeof(v));
+	return;
+}
+
+// read bytes, FALSE if beyond end
+int cache_get(char **p, char *end, void *data, int len) {
+	if ( len < 0 || end - *p < len ) return FALSE;
+	memcpy(data, *p, len);
+	*p += len;
+	return TRUE;
+}
+
+// read name and find symbol of type, obj NULL if none, FALSE if unknown
+int cache_getName(smsCtx *ctx, char **p, char *end, BYTE type, void **obj) {
+	int len, t;
+	*obj = NULL;
+	if ( !cache_get(p, end, &len, sizeof(int)) ) 	return FALSE;
+	if ( len < 0 ) 									return TRUE;
+	if ( end - *p < len ) 							return FALSE;
+	int id = sym_find(ctx, *p, len, &t);
+	*p += len;
+	if ( id == EMPTY_ID || t != type ) 				return FALSE;
+	*obj = ctx->symtab.sym[id].obj;
+	return TRUE;
+}
+
+int cache_getState(smsCtx *ctx, char **p, char *end, smsState *st) {
+	int v[CACHE_STATE];
+	if ( !cache_get(p, end, v, sizeof(v)) ) return FALSE;
+	st->bar 		 = v[0];	st->ppqn 		 = v[1];	st->sngTime 	 = v[2];
+	st->barTime 	 = v[3];	st->P_TIMEBLOCK  = v[4];	st->blkTimeStart = v[5];
+	st->blkTimeEnd 	 = v[6];	st->P_TIMEGROUP  = v[7];	st->grpTimeStart = v[8];
+	st->grpTimeEnd 	 = v[9];	st->grpTimeBar 	 = v[10];	st->P_COMMENT 	 = v[11];
+	st->currentBaseNote = v[12];
+	return cache_getName(ctx, p, end, INST, (void**)&st->currentTrk) && 
+		   cache_getName(ctx, p, end, DRUM, (void**)&st->currentDKey);
+}
+
+int cache_getTrk(char **p, char *end, smsTrkState *ts) {
+	int v[4];
+	if ( !cache_get(p, end, &ts->note, sizeof(smsNote)) || !cache_get(p, end, v, sizeof(v)) ) return FALSE;
+	ts->chft = v[0];	ts->chn = v[1];		ts->bnk = v[2];		ts->prg = v[3];
+	return TRUE;
+}
+
+// decode variant, NULL if entry state doesn't match or data is invalid
+smsBlock *cache_read(smsCtx *ctx, char *p, char *end, smsState *rel) {
+	int v[3], trks, cnt, tempos;
+	smsBlock *blk = block_new(ctx);
+	if ( !cache_get(&p, end, v, sizeof(v)) || !cache_getState(ctx, &p, end, &blk->in) || 
+		 !cache_getState(ctx, &p, end, &blk->out) || !cache_get(&p, end, &trks, sizeof(int)) || 
+		 trks < 0 || trks > ctx->symtab.cnt ) { block_free(ctx, blk); return NULL; }
+	blk->usec		= v[0];
+	blk->size		= v[1];
+	blk->words		= v[2];
+	blk->syms		= ctx->symtab.cnt;
+	blk->cacheable	= TRUE;
+	blk->serial		= ctx->blockSerial++;
+	if ( trks + 1 > blk->trksMax ) {
+		blk->trksMax	= trks + 1;
+		blk->trkIn		= (smsTrkState*)sms_realloc(ctx, blk->trkIn,  sizeof(smsTrkState) * blk->trksMax);
+		blk->trkOut		= (smsTrkState*)sms_realloc(ctx, blk->trkOut, sizeof(smsTrkState) * blk->trksMax);
 	}
-	// proof max of chord note value(24) / tab offset value (24)
-	if( type == BASENOTE || type == ARP) {
-		size = parser_getNumber(data, &value);
-		if(size) {
-			if ( value > NOTE_MAX_OFFSET ) 								return ERR_NOTE_OFFSET; 
-			n->key = value;
-			data  += size;
-		} else {
-			if(data[0] != 'p' && data[0] != 'o' && data[0] != '-')		return ERR_NO_COMMAND;
-			n->key = PAUSE;
-			data++;
-		}
+	for ( ; blk->trks < trks; blk->trks++ ) {
+		smsTrkState *in = &blk->trkIn[blk->trks], *out = &blk->trkOut[blk->trks];
+		if ( !cache_getName(ctx, &p, end, INST, (void**)&in->trk) || !in->trk || 
+			 !cache_getTrk(&p, end, in) || !cache_getTrk(&p, end, out) ) { block_free(ctx, blk); return NULL; }
+		out->trk = in->trk;
 	}
-	// check is valid drum symbol
-	if ( type == DRUM ) {
-		if(data[0] == 'p' || data[0] == '-') data[0] = PAUSE;
-		if(data[0] != BEAT && data[0] != PAUSE ) return ERR_NO_COMMAND; 
-		n->key = data[0];
-		data++;
+	if ( !block_match(blk, rel) || !cache_get(&p, end, &cnt, sizeof(int)) || cnt < 0 || 
+		 end - p < (long long)cnt * (long long)(3 * sizeof(int) + 3) ) { block_free(ctx, blk); return NULL; }
+	int  *time  = (int*)p, *trk = time + cnt, *evtId = trk + cnt;
+	BYTE *status = (BYTE*)(evtId + cnt), *data1 = status + cnt, *data2 = data1 + cnt;
+	p = (char*)(data2 + cnt);
+	for ( int i = 0; i < cnt; i++ ) {
+		int t, n, id;
+		memcpy(&n, &trk[i], sizeof(int));
+		if ( n < 0 || n >= trks ) { block_free(ctx, blk); return NULL; }
+		memcpy(&t,  &time[i],  sizeof(int));
+		memcpy(&id, &evtId[i], sizeof(int));
+		evt_push(ctx, &blk->evt, blk->trkIn[n].trk->id, id, t, status[i], data1[i], data2[i]);
 	}
+	if ( !cache_get(&p, end, &tempos, sizeof(int)) || tempos < 0 || 
+		 end - p < (long long)tempos * (long long)sizeof(smsTempo) ) { block_free(ctx, blk); return NULL; }
+	for ( int i = 0; i < tempos; i++ ) {
+		smsTempo tmp;
+		cache_get(&p, end, &tmp, sizeof(smsTempo));
+		evt_pushTempo(ctx, &blk->evt, tmp.evtId, tmp.bpm);
+	}
+	return blk;
+}
 
-	n->hft 	=   0;
-	n->dot	=	0;
-	
-	//check absolute octave a3>+/16.!46
-	if(type != ARP && type != BASENOTE) {
-		size = parser_getNumber(data, &value);
-		if(size) {
-			if (value > 10 ) 										return ERR_OCTAVE;
-			n->oct = value;
-			data += size;
+// load compiled block of macro for current state, NULL if not in cache
+smsBlock *cache_load(smsCtx *ctx, smsMacro *mac, smsState *st) {
+	long long start = clock_usec();
+	char path[BUFFER + 1];
+	smsBlock *blk = NULL;
+	smsState  rel = *st;
+	state_move(&rel, -st->sngTime);
+	cache_path(ctx, path, mac);
+	FILE *fp = fopen(path, "rb");
+	if ( fp ) {
+		DWORD hdr[2];
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);									// variant lengths are bound by file size
+		rewind(fp);
+		while ( !blk && fread(hdr, sizeof(hdr), 1, fp) == 1 && hdr[0] == CACHE_MAGIC ) {
+			long left = size - ftell(fp);
+			if ( size < 0 || left < 0 || hdr[1] > (unsigned long)left ) break;	// damaged file: miss
+			if ( hdr[1] > CACHE_MAXSIZE ) break;
+			char *data = cache_buf(ctx, (size_t)hdr[1] + 1);
+			if ( !data || fread(data, 1, hdr[1], fp) != hdr[1] ) break;
+			blk = cache_read(ctx, data, data + hdr[1], &rel);
 		}
+		fclose(fp);
 	}
+	if ( blk ) {
+		blk->next	= mac->blocks;
+		mac->blocks	= blk;
+		mac->variants++;
+		ctx->cache.hits++;
+		ctx->cache.saved += blk->usec;
+	} else ctx->cache.misses++;
+	ctx->cache.io += clock_usec() - start;
+	return blk;
+}
 
-	// check qualifier
-	while(strlen(data)) {
-		switch (data[0]) {
-			case HALFTONE_UP:
-			case HALFTON_PLUS:
-				if(type == ARP)										return ERR_ARP_SYMBOL;
-				if(type == DRUM)									return ERR_DRUM_SYMBOL;	
-				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
-				n->hft = n->hft + 1;
-				++data;
-				break;	
-			case HALFTONE_MINUS:
-				if(type == ARP)										return ERR_ARP_SYMBOL;	
-				if(type == DRUM)									return ERR_DRUM_SYMBOL;
-				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
-				n->hft = n->hft - 1;
-				++data;
-				break;				
-			case OCTAVE_UP:
-				if(type == DRUM)									return ERR_DRUM_SYMBOL;
-				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
-				n->oct = n->oct + 1;
-				++data; 
-				if(type == ARP) break;
-				if(n->oct > 10) 									return ERR_OCTAVE;
-				break;
-			case OCTAVE_DOWN:
-				if(type == DRUM)									return ERR_DRUM_SYMBOL;
-				if(type == BASENOTE)								return ERR_BASENOTE_SYMBOL;
-				n->oct = n->oct - 1;
-				++data;
-				if(type == ARP) break;
-				if(n->oct < 1) 										return ERR_OCTAVE; 
-				break;
-			case DURATION_DOT:
-				if(n->dot)											return ERR_DURATION_DOT;
-				n->dot = 1;
-				++data;
-				break;
-			case DURATION:
-				size = parser_getNumber(++data, &value);
-				if(!size) 											return ERR_DURATION;
-				if( value !=  1 && value !=  2 &&  
-					value !=  4 && value !=  8 && 
-					value != 16 && value != 32 &&
-					value != 64 ) 									return ERR_DURATION;
-				n->dur = value;
-				n->dot = 0;
-				data += size;
-				break;
-			case VOLUME:
-				size = parser_getNumber(++data, &value);
-				if(!size) 											return ERR_VOLUME;
-				if (value > 127 ) 									return ERR_VOLUME;
-				n->vol = value;
-				data += size;
-				break;
-			case HOLD:
-				if(data[1]  != '\0')								return ERR_HOLD_NOT_LAST;
-				n->hold = n->key;
-				++data;
-				flgHold = TRUE;
-				break;
-			default: 
-				return ERR_QUALIFIER_SYMBOL;
-		}	
+// write variants of file and variant of file data to temporary file and rename it over the file,
+// so readers see the old or the new file and concurrent stores give no duplicates (one is lost),
+// FALSE if variant is there already (compile time not compared), file is full or not written
+int cache_write(smsCtx *ctx, char *path) {
+	DWORD  len  = ctx->cache.bufLen - 2 * sizeof(DWORD);
+	char  *var  = ctx->cache.buf + 2 * sizeof(DWORD) + sizeof(int);		// after header and usec
+	char  *old  = NULL, tmp[BUFFER + 32];
+	long   size = 0, keep = 0;
+	int    cnt  = 0, fd = -1, ok = TRUE;
+	FILE  *fp   = fopen(path, "rb");
+	if ( fp ) {
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		rewind(fp);
+		old  = ( size > 0 ) ? (char*)sms_malloc(ctx, size) : NULL;
+		if ( !old || fread(old, 1, size, fp) != (size_t)size ) size = 0;	// unreadable: replaced
+		fclose(fp);
 	}
-	
-	if(!flgHold) n->hold = EMPTY;
-	return 	ERR_NOERROR;
+	while ( ok && size - keep >= (long)(2 * sizeof(DWORD)) ) {
+		DWORD hdr[2];
+		memcpy(hdr, old + keep, sizeof(hdr));
+		if ( hdr[0] != CACHE_MAGIC || hdr[1] > (unsigned long)(size - keep - sizeof(hdr)) ) break;	// damaged rest dropped
+		ok    = ++cnt < MACRO_VARIANTS && 
+				( hdr[1] != len || memcmp(old + keep + sizeof(hdr) + sizeof(int), var, len - sizeof(int)) );
+		keep += sizeof(hdr) + hdr[1];
+	}
+#ifdef _WIN32
+	int pid = (int)GetCurrentProcessId();
+#else
+	int pid = (int)getpid();
+#endif
+	for ( int i = 0; ok && fd < 0 && i < 100; i++ ) {	// unique name of worker
+		snprintf(tmp, sizeof(tmp), "%s.%i.%i.tmp", path, pid, i);
+		fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+		if ( fd < 0 && errno != EEXIST ) ok = FALSE;
+	}
+	if ( ok && fd >= 0 ) {
+		ok  = ( keep == 0 || write(fd, old, keep) == keep ) && 
+			  write(fd, ctx->cache.buf, ctx->cache.bufLen) == ctx->cache.bufLen;
+		ok &= ( close(fd) == 0 );
+#ifdef _WIN32
+		ok  = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+		ok  = ok && rename(tmp, path) == 0;
+#endif
+		if ( !ok ) remove(tmp);
+	} else ok = FALSE;
+	sms_free(ctx, old);
+	return ok;
 }
 
-// check is valid base note, e.g. a5#:
-int parser_isBaseNote(char *data) {
-	int bs = EMPTY, pos = 0, oct = 0; 
-	int strSize  = strlen(data);
-	if(strSize < 2)	return EMPTY;
-
-	// check is valid note symbol 
-	switch (data[0]) {
-		case 'c':	bs =    0; 		break;
-		case 'd':	bs =    2;		break;
-		case 'e':	bs =    4; 		break;
-		case 'f':	bs =    5; 		break;
-		case 'g':	bs =    7; 		break;
-		case 'a':	bs =    9; 		break;
-		case 'b':	bs =   11; 		break;
-		default: 	return EMPTY; 	break;
+// store compiled block of macro (blk->usec: clock at block start)
+void cache_store(smsCtx *ctx, smsMacro *mac, smsBlock *blk) {
+	long long start = clock_usec();
+	DWORD hdr[2] = { CACHE_MAGIC, 0 };
+	int   v[3]   = { (int)(start - blk->usec), blk->size, blk->words };
+	smsEvents *flat = &ctx->cache.flat;
+	evt_clear(flat);
+	block_flatten(ctx, flat, &blk->evt, 0, 0);
+	ctx->cache.bufLen = 0;
+	cache_put(ctx, hdr, sizeof(hdr));
+	cache_put(ctx, v, sizeof(v));
+	cache_putState(ctx, &blk->in);
+	cache_putState(ctx, &blk->out);
+	cache_put(ctx, &blk->trks, sizeof(int));
+	for ( int i = 0; i < blk->trks; i++ ) {
+		cache_putName(ctx, blk->trkIn[i].trk->id);
+		cache_putTrk(ctx, &blk->trkIn[i]);
+		cache_putTrk(ctx, &blk->trkOut[i]);
 	}
-	data++; pos++;
-	
-	//check absolute octave
-	int size = parser_getNumber(data, &oct);
-	if(oct > 10) 									return EMPTY;
-	data += size; pos += size;
-	if(pos >= strSize) 								return EMPTY;
-	
-	//check halftone sign '#'
-	if(data[0] == HALFTONE_UP) { bs++; data++, pos++; }
-	if(pos >= strSize) 								return EMPTY;
-	
-	//check final sign ':'
-	if(data[0] != BASENOTE) 						return EMPTY;
-	if(++pos != strSize)							return ERR_BASENOTE;
+	int ok = TRUE;
+	cache_put(ctx, &flat->cnt, sizeof(int));
+	cache_put(ctx, flat->time, sizeof(int) * flat->cnt);
+	for ( int i = 0; i < flat->cnt; i++ ) {					// track as index of used tracks
+		int n = 0;
+		while ( n < blk->trks && blk->trkIn[n].trk->id != flat->trk[i] ) n++;
+		ok &= n < blk->trks;
+		cache_put(ctx, &n, sizeof(int));
+	}
+	cache_put(ctx, flat->evtId,  sizeof(int) * flat->cnt);
+	cache_put(ctx, flat->status, flat->cnt);
+	cache_put(ctx, flat->data1,  flat->cnt);
+	cache_put(ctx, flat->data2,  flat->cnt);
+	cache_put(ctx, &flat->tempos, sizeof(int));
+	cache_put(ctx, flat->tempo,  sizeof(smsTempo) * flat->tempos);
+	hdr[1] = ctx->cache.bufLen - sizeof(hdr);
+	memcpy(ctx->cache.buf, hdr, sizeof(hdr));
+	ok &= ( hdr[1] <= CACHE_MAXSIZE );						// would not be loaded
+	if ( ok ) {												// one rewrite of file per new variant
+		char path[BUFFER + 1];
+		cache_path(ctx, path, mac);
+		if ( cache_write(ctx, path) ) ctx->cache.stores++;
+	}
+	ctx->cache.io += clock_usec() - start;
+	return;
+}
 
-	return bs + (oct * 12);
+// use cache directory (created if missing), FALSE if not possible
+int cache_open(smsCtx *ctx, char *dir) {
+#ifdef _WIN32
+	CreateDirectoryA(dir, NULL);
+	DWORD attr = GetFileAttributesA(dir);
+	if ( attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY) ) return FALSE;
+#else
+	mkdir(dir, 0755);
+	struct stat st;
+	if ( stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ) return FALSE;
+#endif
+	ctx->cache.dir = dir;
+	return TRUE;
 }
 
-// check word is valid chord type
-int parser_isChord(char *word, smsChordNote *cNote) {
-	int type = UNKNOWN;
-	char *c  = (char*)calloc(64, sizeof(char));			// subsegment chord in word
-	char *a  = (char*)calloc(64, sizeof(char));			// subsegment arp   in word
-	int res  = sscanf(word, "%15[^~]~%s", c, a);
-	smsChord *chord;
+/***************************************************************************
+ * checkpoints of compiler state (compiling again after an edit)
+ ***************************************************************************/
 
-	switch (c[0]) {										// check main key
-		case 'C':	cNote->key =  0; break;
-		case 'D':	cNote->key =  2; break;
-		case 'E':	cNote->key =  4; break;
-		case 'F':	cNote->key =  5; break;
-		case 'G':	cNote->key =  7; break;
-		case 'A':	cNote->key =  9; break;
-		case 'B':	cNote->key = 11; break;
-		default :   return ERR_NO_COMMAND;
+// At start of each top level line the compiler state is kept: position, header values,
+// number of symbols, events and compiled blocks, state of tracks. The compiling after an 
+// edit continues at the last checkpoint before the first changed byte, everything made 
+// later is removed (symbols, event blocks, events, word cache entries of chords).
+
+// free checkpoints from index on
+void edit_drop(smsCtx *ctx, int from) {
+	if ( from >= ctx->edits.cnt ) return;
+	ctx->edits.trks = ctx->edits.cp[from].trk;
+	ctx->edits.cnt  = from;
+	return;
+}
+
+// end compiler state of edits (objects of song are freed by next initSMS), memory is kept
+void edit_end(smsCtx *ctx) {
+	edit_drop(ctx, 0);
+	ctx->edits.kept = FALSE;
+	ctx->edits.len  = 0;
+	return;
+}
+
+// keep compiler state at start of line
+void edit_checkpoint(smsCtx *ctx, smsState *st, smsHeader *sms, int pos, int line, int words, int blockComment) {
+	if ( ctx->edits.cnt == ctx->edits.max ) {
+		ctx->edits.max = ( ctx->edits.max ) ? ctx->edits.max * 2 : 256;
+		ctx->edits.cp  = (smsCheckpoint*)sms_realloc(ctx, ctx->edits.cp, ctx->edits.max * sizeof(smsCheckpoint));
 	}
-	c++;
-	if (c[0]==HALFTONE_UP || c[0]==HALFTON_PLUS) {cNote->hft = 1; c++;};	// check halftone
-	if ( !strlen(c) ) 								return ERR_KEYCHORD;	// no given key chord 	
-	chord  = getObject(c, &type);											// search chord
-	if ( !chord || type != CHORD) 					return ERR_KEYCHORD;	// wrong key chord
+	smsCheckpoint *cp = &ctx->edits.cp[ctx->edits.cnt++];
+		cp->pos				= pos;
+		cp->line			= line;
+		cp->words			= words;
+		cp->st				= *st;
+		cp->P_BLOCKCOMMENT	= blockComment;
+		cp->sms				= *sms;
+		cp->syms			= ctx->symtab.cnt;
+		cp->evts			= ctx->events.cnt;
+		cp->tempos			= ctx->events.tempos;
+		cp->refs			= ctx->events.refs;
+		cp->blocks			= ctx->blockSerial;
+		cp->trk				= ctx->edits.trks;
+		cp->trks			= 0;
+	for ( int id = 0; id < ctx->symtab.cnt; id++ ) {
+		if ( ctx->symtab.sym[id].type != INST ) continue;
+		if ( ctx->edits.trks == ctx->edits.trksMax ) {
+			ctx->edits.trksMax = ( ctx->edits.trksMax ) ? ctx->edits.trksMax * 2 : 1024;
+			ctx->edits.trk     = (smsEditTrk*)sms_realloc(ctx, ctx->edits.trk, ctx->edits.trksMax * sizeof(smsEditTrk));
+		}
+		smsTrack *trk = ctx->symtab.sym[id].obj;
+		ctx->edits.trk[ctx->edits.trks++] = (smsEditTrk){ trk, *trk->note, *trk->cnote, trk->chn, trk->bnk, trk->prg };
+		cp->trks++;
+	}
+	return;
+}
 
-	cNote->chord = chord;
-	cNote->arp = NULL;
-	if ( strlen(a) ) {															// check arpreggio
-		void *p = getObject(a, &type);
-		if ( !p || type != ARP )						return ERR_ARP;			// word as arp macro not found
-		cNote->arp = (smsMacro*)p;
+// take script data of edit (own copy, words of kept macros are moved into it if it grows),
+// returns checkpoint to continue at or EMPTY_ID (compiling from start)
+int edit_begin(smsCtx *ctx, char **data, int len) {
+	smsEdits *ed = &ctx->edits;
+	int d = 0, resume = EMPTY_ID;
+	if ( ed->kept ) while ( d < len && d < ed->len && (*data)[d] == ed->data[d] ) d++;
+	// line before checkpoint unchanged, new line char not followed by a changed one (crlf)
+	for ( int i = ed->cnt - 1; i >= 0 && resume == EMPTY_ID; i-- ) {
+		int pos = ed->cp[i].pos;
+		if ( pos < d || (pos == d && pos > 0 && ed->data[pos - 1] == NEWLINE) ) resume = i;
 	}
-	
-	return ERR_NOERROR;
+	if ( resume == EMPTY_ID ) edit_end(ctx);
+	char *copy = ed->data;
+	if ( len + 1 > ed->dataMax ) {
+		ed->dataMax = len + 1 + len / 2;
+		copy = (char*)sms_malloc(ctx, ed->dataMax);
+		for ( int id = 0; resume != EMPTY_ID && id < ed->cp[resume].syms; id++ ) {
+			BYTE type = ctx->symtab.sym[id].type;
+			if ( type != MACRO && type != ARP ) continue;
+			smsMacro *mac = ctx->symtab.sym[id].obj;
+			for ( int w = 0; w < mac->size; w++ ) mac->list[w].ptr = copy + (mac->list[w].ptr - ed->data);
+		}
+		sms_free(ctx, ed->data);
+	}
+	memcpy(copy, *data, len);				// words before checkpoint are unchanged
+	ed->data = copy;
+	ed->len  = len;
+	*data = copy;
+	return resume;
+}
+
+// set compiler state of checkpoint, later symbols, blocks, events and checkpoints are removed
+void edit_restore(smsCtx *ctx, int resume, smsHeader *sms) {
+	smsCheckpoint *cp = &ctx->edits.cp[resume];
+	freeObjectsFrom(ctx, cp->syms);
+	for ( int id = 0; id < ctx->symtab.cnt; id++ ) {
+		BYTE type = ctx->symtab.sym[id].type;
+		if ( type != MACRO && type != ARP ) continue;
+		smsMacro *mac = ctx->symtab.sym[id].obj;
+		while ( mac->blocks && mac->blocks->serial >= cp->blocks ) {	// newest blocks first
+			smsBlock *blk = mac->blocks;
+			mac->blocks = blk->next;
+			block_free(ctx, blk);
+		}
+		mac->active   = FALSE;								// compiling stopped in macro
+		mac->variants = 0;
+		for ( smsBlock *blk = mac->blocks; blk && blk->syms == ctx->symtab.cnt; blk = blk->next ) mac->variants++;
+		if ( mac->depSyms > cp->syms ) mac->depSyms = EMPTY_ID;
+	}
+	for ( int i = 0; i < ctx->memo.cnt; i++ ) if ( ctx->memo.ent[i].syms > cp->syms ) ctx->memo.ent[i].syms = EMPTY_ID;
+	ctx->memo.hits = ctx->memo.misses = 0;
+	ctx->events.cnt    = cp->evts;
+	ctx->events.tempos = cp->tempos;
+	ctx->events.refs   = cp->refs;
+	for ( int i = cp->trk; i < cp->trk + cp->trks; i++ ) {
+		smsEditTrk *et = &ctx->edits.trk[i];
+		*et->trk->note  = et->note;
+		*et->trk->cnote = et->cnote;
+		et->trk->chn = et->chn;
+		et->trk->bnk = et->bnk;
+		et->trk->prg = et->prg;
+	}
+	*sms = cp->sms;
+	edit_drop(ctx, resume + 1);
+	return;
 }
 
 /***************************************************************************
  * sms2midi compiler
  ***************************************************************************/
 
-// create event list, sorted by track, then time, then evtId
+// create event list of track, sorted by time, then evtId (sort keys of track bucket)
 int evt_compare (const void * left, const void * right) {
 	
-	smsEvent * evtLeft  = (smsEvent *) left;
-	smsEvent * evtRight = (smsEvent *) right;
+	const smsEvtKey *l = left;
+	const smsEvtKey *r = right;
 
-	int res = strcmp( evtLeft->trkname, evtRight->trkname );
-	if (res) return res;
-	
-	if( evtLeft->time < evtRight->time ) 	return -1;
-	if( evtLeft->time > evtRight->time ) 	return  1;
+	if( l->time < r->time ) 		return -1;
+	if( l->time > r->time ) 		return  1;
 	
-	if ( evtLeft->evtId < evtRight->evtId )	return -1;
-	if ( evtLeft->evtId > evtRight->evtId )	return  1;
+	if ( l->evtId < r->evtId )	return -1;
+	if ( l->evtId > r->evtId )	return  1;
 
 	return 0;
 }
 
-struct BUF *parser_createMidi(smsHeader *sms) {
-	smsEvent *evt = evtFirst, *evt_old;
-	smsEvent evtList[sms->evts];
-
-    // prepare sort list and sorting
-	for ( int i = 0; i < sms->evts; i++) {
-		evtList[i].trkname = evt->trkname;
-		evtList[i].evtId   = evt->evtId;
-		evtList[i].time	   = evt->time;
-		evtList[i].status  = evt->status;
-		evtList[i].data1   = evt->data1;
-		evtList[i].data2   = evt->data2;
-		evtList[i].bpm	   = evt->bpm;
-		evt 	= evt->next;
-	}
-	qsort(evtList, sms->evts, sizeof(smsEvent), evt_compare);
-
-	// generate midi tracks
-	int cntTrk = 0;
-	struct BUF *mtrk;												// pointer for midi tracks
-	smsTrack *strk;													// pointer for sms track			
-	smsEvent last  = { .trkname = "SMS", .time = 0};
-	int songTime, type, device;
-	float ms = 60000000.0 / sms->bpm;								// calculate base tempo in microsec
-	for ( int i = 0; i < sms->evts; i++) {
-		if ( strcmp( last.trkname, evtList[i].trkname ) != 0) {		// new midi track
-			strk = getObject(evtList[i].trkname, &type);
-			mtrk = newTRK();
-			if (i == 0) {			
-				//write global midi file informations only in first track
-				writeTMP(mtrk, (int)ms);							// set tempo in first track
-				writeMTA(mtrk, EVT_CPR, "(c) ma.ke. 2024"); 		// set copyright note
-				writeMTA(mtrk, EVT_PRG, "created with HIDCAM-SMS"); // set program name
+// key order of events in track bucket: time, then evtId
+#define EVT_LESS(e, a, b)	( (e)->time[a] < (e)->time[b] || \
+							 ((e)->time[a] == (e)->time[b] && (e)->evtId[a] < (e)->evtId[b]) )
+
+// sort events of track bucket into order (index), stable natural merge sort:
+// events arrive nearly in time order, only time blocks, time groups 
+// and note offs start new runs, so a few merge passes of the runs are enough
+// 		order, tmp	 index buffers of event number
+//		run			 buffer of event number + 1 (start of runs)
+void evt_sort(smsEvents *e, int *order, int *tmp, int *run) {
+	int n = e->cnt, runs = 0;
+	for ( int i = 0; i < n; i++ ) {
+		if ( i == 0 || EVT_LESS(e, i, i - 1) ) run[runs++] = i;
+		order[i] = i;
+	}
+	run[runs] = n;
+	int *src = order, *dst = tmp;
+	while ( runs > 1 ) {										// merge pairs of runs
+		int r, w = 0;
+		for ( r = 0; r + 1 < runs; r += 2 ) {
+			int a = run[r], aEnd = run[r + 1], b = aEnd, bEnd = run[r + 2], d = a;
+			while ( a < aEnd && b < bEnd ) 
+				dst[d++] = ( EVT_LESS(e, src[b], src[a]) ) ? src[b++] : src[a++];
+			while ( a < aEnd ) dst[d++] = src[a++];
+			while ( b < bEnd ) dst[d++] = src[b++];
+			run[w++] = run[r];
+		}
+		if ( r < runs ) {										// odd run left
+			memcpy(dst + run[r], src + run[r], (n - run[r]) * sizeof(int));
+			run[w++] = run[r];
+		}
+		run[w] = n;
+		runs   = w;
+		int *swap = src; src = dst; dst = swap;
+	}
+	if ( src != order ) memcpy(order, src, n * sizeof(int));
+	return;
+}
+
+// tracks sorted by name
+int trk_compare (const void * left, const void * right) {
+	return strcmp( ((smsTrkKey*)left)->name, ((smsTrkKey*)right)->name );
+}
+
+// tempo changes sorted by event number
+int tempo_compare (const void * left, const void * right) {
+	return ((smsTempo*)left)->evtId - ((smsTempo*)right)->evtId;
+}
+
+// get bpm of tempo change with event number
+int tempo_find(smsEvents *e, int evtId) {
+	smsTempo key = { evtId, 0 };
+	smsTempo *t  = bsearch(&key, e->tempo, e->tempos, sizeof(smsTempo), tempo_compare);
+	return ( t ) ? t->bpm : 0;
+}
+
+// encode midi track of job: sort events and write midi messages
+void parser_encodeTrack(smsCtx *ctx, smsTrkJob *job, smsEvents *tempo, float ms) {
+	smsEvents *list  = job->list;
+	int       *order = job->order;								// sort buffers sized by parser_createMidi
+	// sort events of track
+	if ( ctx->sortGeneric ) {
+		for ( int i = 0; i < list->cnt; i++ ) job->key[i] = (smsEvtKey){ list->time[i], list->evtId[i], i };
+		qsort(job->key, list->cnt, sizeof(smsEvtKey), evt_compare);
+		for ( int i = 0; i < list->cnt; i++ ) order[i] = job->key[i].idx;
+	} else {
+		evt_sort(list, order, job->tmp, job->run);
+	}
+	smsTrack   *strk = sym_object(ctx, job->trkId);						// pointer for sms track
+	const char *name = sym_name(ctx, job->trkId);
+	int         cnt  = list->cnt;
+
+	// compact: note off as note on with velocity 0, drop bank and program already set on channel
+	if ( ctx->compact ) {
+		int bnk = strk->bnk, prg = strk->prg, bnkNew = FALSE, n = 0;
+		for ( int k = 0; k < cnt; k++ ) {
+			int  i  = order[k];
+			BYTE st = list->status[i];
+			if ( (st & 0xf0) == 0x80 ) { list->status[i] = 0x90 | (st & 0x0f); list->data2[i] = 0; }
+			if ( k == cnt - 1 ) { order[n++] = i; break; }				// last event keeps track length
+			if ( job->solo && st == 0xB0 + strk->chn && list->data1[i] == 0 ) {
+				if ( list->data2[i] == bnk ) continue;					// same bank
+				bnk    = list->data2[i];
+				bnkNew = TRUE;											// next program change needed
 			}
-			writeMTA(mtrk, EVT_DEV, evtList[i].trkname);
-			
-			// set drum kit or instrument
-			writeMSG(mtrk, 0, 0xB0 + strk->chn,         0, strk->bnk);
-			writeMSG(mtrk, 0, 0xC0 + strk->chn, strk->prg, 0);
-			songTime = 0;
-			cntTrk++;
+			if ( job->solo && st == 0xC0 + strk->chn ) {
+				if ( list->data1[i] == prg && !bnkNew ) continue;		// same program
+				prg    = list->data1[i];
+				bnkNew = FALSE;
+			}
+			order[n++] = i;
+		}
+		cnt = n;
+	}
+
+	// sizing pass: exact size of track data
+	int size = sizeMTA(name) + sizeMSG(0, 0xB0) + sizeMSG(0, 0xC0);
+	if ( job->first ) size += 7 + sizeMTA(TXT_COPYRIGHT) + sizeMTA(TXT_PROGRAM);
+	struct MTRK run = { 0, NULL, 0xC0 + strk->chn };				// running status after program
+	int songTime = 0;
+	for ( int k = 0; k < cnt; k++) {
+		int i = order[k];
+		if ( list->status[i] == 0 ) {
+			size          += 7;
+			run.lastStatus = 0;											// meta event cancels running status
+		} else if ( ctx->compact ) {
+			size += sizeRUN(&run, list->time[i] - songTime, list->status[i]);
+		} else {
+			size += sizeMSG(list->time[i] - songTime, list->status[i]);
 		}
-		int timediv = evtList[i].time - songTime;
-		songTime    = evtList[i].time;
+		songTime = list->time[i];
+	}
+
+	// writing pass
+	struct BUF *mtrk = job->mtrk;									// pointer for midi track
+	if ( mtrk->len < size + 1 ) {
+		mtrk->mem = realloc(mtrk->mem, size + 1);
+		mtrk->len = size + 1;
+	}
+	mtrk->cnt = size;
+	BYTE *p   = (BYTE*)mtrk->mem;
+	if ( job->first ) {			
+		//write global midi file informations only in first track
+		p = putTMP(p, (int)ms);										// set tempo in first track
+		p = putMTA(p, EVT_CPR, TXT_COPYRIGHT); 						// set copyright note
+		p = putMTA(p, EVT_PRG, TXT_PROGRAM); 						// set program name
+	}
+	p = putMTA(p, EVT_DEV, name);
+	
+	// set drum kit or instrument
+	p = putMSG(p, 0, 0xB0 + strk->chn,         0, strk->bnk);
+	p = putMSG(p, 0, 0xC0 + strk->chn, strk->prg, 0);
+	run      = (struct MTRK){ 0, NULL, 0xC0 + strk->chn };
+	songTime = 0;
+	for ( int k = 0; k < cnt; k++) {
+		int i = order[k];
+		int timediv = list->time[i] - songTime;
+		songTime    = list->time[i];
 		// change tempo
-		if (evtList[i].bpm > 0) {									
-			ms = 60000000.0 / evtList[i].bpm;
-			writeTMP(mtrk, (int)ms);					
+		if ( list->status[i] == 0 ) {									
+			ms = 60000000.0 / tempo_find(tempo, list->evtId[i]);
+			p  = putTMP(p, (int)ms);					
+			run.lastStatus = 0;
+		} else if ( ctx->compact ) {
+			// write midi message with running status
+			p = putRUN(p, &run, timediv, list->status[i], list->data1[i], list->data2[i]);
 		} else {
 			// write midi message
-			writeMSG(mtrk, timediv, evtList[i].status, evtList[i].data1, evtList[i].data2);
+			p = putMSG(p, timediv, list->status[i], list->data1[i], list->data2[i]);
+		}
+	}
+	evt_clear(list);
+	return;
+}
+
+// worker thread: encode every step-th track job
+THREAD_RESULT parser_encodeWorker(void *arg) {
+	smsWorker *w   = arg;
+	smsCtx    *ctx = w->ctx;
+	for ( int j = w->start; j < w->jobs; j += w->step ) parser_encodeTrack(ctx, &w->job[j], w->tempo, w->ms);
+	return 0;
+}
+
+// create midi file of song, fd < 0: as SMF buffer, else written to file descriptor
+struct BUF *parser_createMidi(smsCtx *ctx, smsHeader *sms, int fd) {
+	// one event bucket per track, tracks in order of names
+	int trks = 0;
+	if ( ctx->slotMax < ctx->symtab.cnt ) {
+		ctx->slotMax = ctx->symtab.cnt;
+		ctx->slot    = (int*)sms_realloc(ctx, ctx->slot, ctx->slotMax * sizeof(int));
+	}
+	for ( int id = 0; id < ctx->symtab.cnt; id++ ) if ( ctx->symtab.sym[id].type == INST ) trks++;
+	if ( ctx->trksMax < trks ) {											// new buckets and jobs are empty
+		ctx->bucket = (smsEvents*)sms_realloc(ctx, ctx->bucket, trks * sizeof(smsEvents));
+		ctx->job    = (smsTrkJob*)sms_realloc(ctx, ctx->job,    trks * sizeof(smsTrkJob));
+		ctx->trkKey = (smsTrkKey*)sms_realloc(ctx, ctx->trkKey, trks * sizeof(smsTrkKey));
+		memset(ctx->bucket + ctx->trksMax, 0, (trks - ctx->trksMax) * sizeof(smsEvents));
+		memset(ctx->job    + ctx->trksMax, 0, (trks - ctx->trksMax) * sizeof(smsTrkJob));
+		ctx->trksMax = trks;
+	}
+	smsEvents *bucket = ctx->bucket;
+	smsTrkKey *trkKey = ctx->trkKey;
+	int       *slot   = ctx->slot;
+	trks = 0;
+	for ( int id = 0; id < ctx->symtab.cnt; id++ ) {
+		slot[id] = EMPTY_ID;
+		if ( ctx->symtab.sym[id].type == INST ) { slot[id] = trks; trkKey[trks++] = (smsTrkKey){ sym_name(ctx, id), id }; }
+	}
+	qsort(trkKey, trks, sizeof(smsTrkKey), trk_compare);
+
+    // fill buckets (materialize macro event blocks)
+	smsEvents *tempo = &ctx->tempo;
+	for ( int t = 0; t < trks; t++ ) evt_clear(&bucket[t]);
+	evt_clear(tempo);
+	block_emit(ctx, bucket, slot, tempo, &ctx->events, 0, 0);
+	if ( tempo->tempos ) qsort(tempo->tempo, tempo->tempos, sizeof(smsTempo), tempo_compare);
+
+	// one job per midi track, tracks without events are skipped,
+	// midi buffers and sort buffers are taken before the workers start
+	smsTrkJob *job  = ctx->job;
+	int        jobs = 0;
+	int        chnTrks[16] = { 0 };									// number of tracks on channel
+	for ( int t = 0; t < trks; t++ ) {
+		smsEvents *list = &bucket[slot[trkKey[t].id]];
+		if ( !list->cnt ) continue;
+		smsTrkJob *jb = &job[jobs];
+		jb->list  = list;
+		jb->trkId = trkKey[t].id;
+		jb->first = ( jobs == 0 );
+		jb->mtrk  = spareBUF(&ctx->trks);
+		if ( jb->max < list->cnt + 1 ) {
+			jb->max   = list->cnt + 1;
+			jb->order = (int*)sms_realloc(ctx, jb->order, jb->max * sizeof(int));
+			jb->tmp   = (int*)sms_realloc(ctx, jb->tmp,   jb->max * sizeof(int));
+			jb->run   = (int*)sms_realloc(ctx, jb->run,   jb->max * sizeof(int));
+			jb->key   = (smsEvtKey*)sms_realloc(ctx, jb->key, jb->max * sizeof(smsEvtKey));
 		}
-		last = evtList[i];
+		chnTrks[((smsTrack*)sym_object(ctx, jb->trkId))->chn & 0x0f]++;
+		jobs++;
+	}
+	for ( int j = 0; j < jobs; j++ ) 
+		job[j].solo = ( chnTrks[((smsTrack*)sym_object(ctx, job[j].trkId))->chn & 0x0f] == 1 );
+
+	// encode tracks with worker threads, the calling thread is worker 0
+	int threads = thread_cpus();
+	if ( threads > MAX_THREADS ) 							threads = MAX_THREADS;
+	if ( ctx->threads && threads > ctx->threads )			threads = ctx->threads;
+	if ( threads > jobs ) 									threads = jobs;
+	if ( sms->evts < PARALLEL_MIN || ctx->sortGeneric ) 		threads = 1;
+	smsWorker worker[MAX_THREADS];
+	smsThread thread[MAX_THREADS];
+	int       started[MAX_THREADS] = { 0 };
+	float     ms = 60000000.0 / sms->bpm;						// calculate base tempo in microsec
+	for ( int w = 0; w < threads; w++ ) {
+		worker[w] = (smsWorker){ ctx, job, jobs, w, threads, tempo, ms };
+		if ( w ) started[w] = thread_start(&thread[w], parser_encodeWorker, &worker[w]);
+	}
+	if ( threads ) parser_encodeWorker(&worker[0]);
+	for ( int w = 1; w < threads; w++ ) {
+		if ( started[w] ) thread_join(thread[w]);
+		else parser_encodeWorker(&worker[w]);					// thread not started
 	}
-	struct BUF *smf = newSMF(sms->ppqn);
-	freeTRKs();
-	free(evtList);
+
+	// assemble midi tracks in order of names, buffers are kept for next compiling
+	for ( int j = 0; j < jobs; j++ ) linkTRK(&ctx->trks, job[j].mtrk);
+	if ( ctx->format0 ) mergeTRKs(&ctx->trks, ctx->compact);		// one track, midi file type 0
+	struct BUF *smf = ( fd < 0 ) ? newSMF(&ctx->trks, sms->ppqn) : streamSMF(&ctx->trks, fd, sms->ppqn);
+	clearTRKs(&ctx->trks);
 	return smf;
 }
 
-struct BUF *sms2midi(char *data, char **msg) {  
+// copy compiler position into state and back (macro event blocks)
+#define STATE_GET(st)	{	(st).bar = sms->bar; (st).ppqn = sms->ppqn;							\
+							(st).sngTime = sngTime; (st).barTime = barTime;						\
+							(st).P_TIMEBLOCK = P_TIMEBLOCK; (st).blkTimeStart = blkTimeStart;	\
+							(st).blkTimeEnd = blkTimeEnd; (st).P_TIMEGROUP = P_TIMEGROUP;		\
+							(st).grpTimeStart = grpTimeStart; (st).grpTimeEnd = grpTimeEnd;		\
+							(st).grpTimeBar = grpTimeBar; (st).P_COMMENT = P_COMMENT;			\
+							(st).currentBaseNote = currentBaseNote;								\
+							(st).currentTrk = currentTrk; (st).currentDKey = currentDKey; }
+#define STATE_SET(st)	{	sms->bar = (st).bar; sms->ppqn = (st).ppqn;							\
+							sngTime = (st).sngTime; barTime = (st).barTime;						\
+							P_TIMEBLOCK = (st).P_TIMEBLOCK; blkTimeStart = (st).blkTimeStart;	\
+							blkTimeEnd = (st).blkTimeEnd; P_TIMEGROUP = (st).P_TIMEGROUP;		\
+							grpTimeStart = (st).grpTimeStart; grpTimeEnd = (st).grpTimeEnd;		\
+							grpTimeBar = (st).grpTimeBar; P_COMMENT = (st).P_COMMENT;			\
+							currentBaseNote = (st).currentBaseNote;								\
+							currentTrk = (st).currentTrk; currentDKey = (st).currentDKey; }
+
+struct BUF *parser_sms2midi(smsCtx *ctx, char *data, int len, char **msg, int fd, int *bar, int edit, int *from) {  
+	// compiling after edit continues at checkpoint, otherwise state of edits is dropped
+	int resume = EMPTY_ID;
+	if ( edit ) 		   resume = edit_begin(ctx, &data, len);
+	else if ( ctx->edits.kept ) { freeSMS(ctx); edit_end(ctx); }
+
 // initialize global variables
 	int cntLINE      = 1, cntLINE_WORD     = 0, cntWORD = 0; 
 	int cntMACLINE   = 1, cntMACLINE_WORD  = 0;
 	int cntINC		 = 0, cntINC_WORD	   = 0;
-	int cntARPLINE	 = 1, cntARPLINE_WORD  = 0; char *ARPWORD  = NULL;
+	int cntARPLINE	 = 1, cntARPLINE_WORD  = 0; char ARPWORD[BUFFER];
 	int cntHOLDLINE  = 1, cntHOLDLINE_WORD = 0;
 	char *SMSWORD    = NULL;
+	char  SMSWORDBUF[BUFFER];					// null terminated copy of current word
+	smsToken SMSTOKEN;								// current word as view
+	smsLexer SMSLEXER;								// word reader for script data
+	lexer_init(&SMSLEXER, data, len);
 	
 	// used for repeating
 	char  LASTWORD[BUFFER];						// merge last word
 	int   lastWordType = UNKNOWN;				// flag: UNKNOWN, MACRO_END
 	int   macroRepeater = 0;					// number of repetitions
+	int   macroRepeat   = 0;					// remaining repetitions of current macro
+	int   macroPos      = 0;					// read position in macro word list
+	smsFrame *frames    = ctx->frames;			// enclosing macros of nested macro
+	int   depth = 0, depthMax = ctx->framesMax;	// number of enclosing macros
+	smsBlock *rec       = NULL;					// nearest macro event block in compiling
+	int   recOwn        = FALSE;				// TRUE if rec belongs to current macro
+	smsState  st;								// compiler position for macro event blocks
 
 	int err = ERR_NOERROR;
 	int token, res, type, value = 0;	
@@ -1327,7 +4371,6 @@ struct BUF *sms2midi(char *data, char **msg) {
 	int   P_CMDTYPE	 		= UNKNOWN;
 	int   P_NEXTWORD 		= FALSE;
 	int   P_MACRO 	 		= IDLE;
-	char *P_MACRO_COMMANDS	= NULL;
 	int   P_INC				= FALSE;
 	char *P_INC_COMMANDS	= NULL;
 	int	  P_TIMEBLOCK 		= IDLE;
@@ -1340,50 +4383,33 @@ struct BUF *sms2midi(char *data, char **msg) {
 	int blkTimeStart = TIME_OFF, blkTimeEnd = TIME_OFF;
 	int grpTimeStart = TIME_OFF, grpTimeEnd = TIME_OFF, grpTimeBar = TIME_OFF;
 	
-	// default header setup
-	smsHeader *sms  = initSMS("SMS");	
-	
-	// initialize standard key chord types major and minor 
-	smsChord *c;
-	c = newSmsChord("maj");   (*c).keys = (char[]) { 0, 4,   7,   EMPTY, EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("7");     (*c).keys = (char[]) { 0, 4,   7,    10,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("maj7");  (*c).keys = (char[]) { 0, 4,   7,    11,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("6");     (*c).keys = (char[]) { 0, 4,   7,     9,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("6/9");   (*c).keys = (char[]) { 0, 4,   7,     9,    14,   EMPTY, EMPTY };	
-	c = newSmsChord("5");     (*c).keys = (char[]) { 0, 7, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY };	
-	c = newSmsChord("9");     (*c).keys = (char[]) { 0, 4,   7,    10,    14,   EMPTY, EMPTY };	
-	c = newSmsChord("maj9");  (*c).keys = (char[]) { 0, 4,   7,    10,    13,   EMPTY, EMPTY };	
-	c = newSmsChord("11");    (*c).keys = (char[]) { 0, 4,   7,    10,    14,    16,   EMPTY };
-	c = newSmsChord("13");    (*c).keys = (char[]) { 0, 4,   7,    10,    14,    17,    21   };	
-	c = newSmsChord("maj13"); (*c).keys = (char[]) { 0, 4,   7,    11,    14,    21,   EMPTY };
-	c = newSmsChord("add");   (*c).keys = (char[]) { 0, 4,   7,    14,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("7-5");   (*c).keys = (char[]) { 0, 4,   6,    10,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("7+5");   (*c).keys = (char[]) { 0, 4,   8,    10,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("sus");   (*c).keys = (char[]) { 0, 5,   7,   EMPTY, EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("dim");   (*c).keys = (char[]) { 0, 3,   6,   EMPTY, EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("dim7");  (*c).keys = (char[]) { 0, 3,   6,     9,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("aug");   (*c).keys = (char[]) { 0, 3,   8,   EMPTY, EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("aug7");  (*c).keys = (char[]) { 0, 3,  10,   EMPTY, EMPTY, EMPTY, EMPTY };
-	// minor chords
-	c = newSmsChord("m");     (*c).keys = (char[]) { 0, 3,   7,   EMPTY, EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("m7");    (*c).keys = (char[]) { 0, 3,   7,    10,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("mM7");   (*c).keys = (char[]) { 0, 3,   7,    11,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("m6");    (*c).keys = (char[]) { 0, 3,   7,     9,   EMPTY, EMPTY, EMPTY };
-	c = newSmsChord("m9");    (*c).keys = (char[]) { 0, 3,   7,    10,    14,   EMPTY, EMPTY };
-	c = newSmsChord("m11");   (*c).keys = (char[]) { 0, 3,   7,    10,    14,    16,   EMPTY };
-	c = newSmsChord("m13");   (*c).keys = (char[]) { 0, 3,   7,    10,    14,    17,    21   };
-	c = newSmsChord("m7b5");  (*c).keys = (char[]) { 0, 3,   6,    10,   EMPTY, EMPTY, EMPTY };
-	sms->chords = 27;
-
-	// set default instrument, drum track and drumkey
-    smsTrack  	*defaultInstTrk 	= newSmsTrk("INST"); 		// create default instrument track
-	// set drum track and default drumkey
-	smsTrack  	*DrumTrk 			= newSmsTrk("DRUM"); 		// create drum track and
-				 DrumTrk->chn		= 9;						// set midi drum channel to 9
-	smsDrumKey	*defaultDKey		= newSmsDrumKey("TICK:");	// create standard drum key
-				
-	sms->trks 		+=2;
-	sms->drumkeys 	+=1;
+	smsHeader	*sms;
+	smsTrack	*defaultInstTrk, *DrumTrk;
+	smsDrumKey	*defaultDKey;
+	if ( resume == EMPTY_ID ) {
+		// default header setup
+		sms = initSMS(ctx, "SMS");	
+		
+		// standard key chord types are built-in
+		sms->chords = BUILTIN_CHORDS;
+
+		// set default instrument, drum track and drumkey
+		defaultInstTrk 	= newSmsTrk(ctx, "INST", 4);		// create default instrument track
+		// set drum track and default drumkey
+		DrumTrk 		= newSmsTrk(ctx, "DRUM", 4);		// create drum track and
+		DrumTrk->chn	= 9;						// set midi drum channel to 9
+		defaultDKey		= newSmsDrumKey(ctx, "TICK:", 5);	// create standard drum key
+					
+		sms->trks 		+=2;
+		sms->drumkeys 	+=1;
+		if ( edit ) ctx->edits.kept = TRUE;
+	} else {
+		// objects of compiling before edit
+		sms				= &ctx->sms;
+		defaultInstTrk	= sym_object(ctx, 0);
+		DrumTrk			= sym_object(ctx, 1);
+		defaultDKey		= sym_object(ctx, 2);
+	}
 
 	// variables for current events to process
 	smsTrack     *currentTrk 		= defaultInstTrk;	// current process instrument track
@@ -1393,6 +4419,18 @@ struct BUF *sms2midi(char *data, char **msg) {
 	smsMacro	 *currentArp   		= NULL;				// current process arp
 	int           currentBaseNote 	= EMPTY;			// current base note value
 	int           boundStart   		= 0;				// current bound start (word number)
+
+	// continue at start of line before edit
+	if ( resume != EMPTY_ID ) {
+		smsCheckpoint *cp = &ctx->edits.cp[resume];
+		edit_restore(ctx, resume, sms);
+		SMSLEXER.pos	= cp->pos;
+		cntLINE			= cp->line;
+		cntWORD			= cp->words;
+		P_BLOCKCOMMENT	= cp->P_BLOCKCOMMENT;
+		STATE_SET(cp->st);
+	}
+	if ( from ) *from = ( resume == EMPTY_ID ) ? 1 : cntLINE;
 	
 // ----------------------------------------------------------------------------------------	
 // BEGIN word read main loop until end of data
@@ -1414,30 +4452,52 @@ struct BUF *sms2midi(char *data, char **msg) {
 								break;
 			}
 			if(err) break;
+			lexer_view(&SMSTOKEN, SMSWORD);
 			token = UNKNOWN;
 			goto NEXT_WORD_READY;
 		}
 	
 NEXT_WORD_READ:
-		if(SMSWORD) strcpy(LASTWORD, SMSWORD); 		// prepare for possible repetition
+		if(SMSWORD && SMSWORD != LASTWORD) strcpy(LASTWORD, SMSWORD); 	// prepare for possible repetition
 		if ( P_MACRO == PASSING )  {
-			SMSWORD = ( !SMSWORD ) ? strtok(P_MACRO_COMMANDS, " ") : strtok(NULL, " ");
-			if ( SMSWORD ) {
-				token = ( strlen(SMSWORD) == 1 ) ? SMSWORD[0] : UNKNOWN;
+			if ( macroPos < currentMac->size ) {
+				SMSTOKEN = currentMac->list[macroPos++];
+				SMSWORD  = lexer_copy(&SMSTOKEN, SMSWORDBUF);
+				token = ( SMSTOKEN.len == 1 ) ? SMSWORD[0] : UNKNOWN;
 				cntMACLINE_WORD++;
-			} else {
-				P_MACRO 	= IDLE;
-				strcpy(LASTWORD, currentMac->name);
+			} else {											// end of macro
+				if ( recOwn ) {									// keep compiled event block
+					STATE_GET(st);
+					int keep = rec->cacheable;
+					block_end(ctx, currentMac, rec, &st, sms, cntWORD);
+					if ( keep && ctx->cache.dir ) cache_store(ctx, currentMac, rec);
+				}
+				currentMac->active = FALSE;
+				strcpy(LASTWORD, sym_name(ctx, currentMac->id));
 				lastWordType = MACRO;				
-				if(macroRepeater) { 
-					P_REPEAT = --macroRepeater;
-					continue;	
+				SMSWORD      = NULL;
+				int repeat   = macroRepeat;
+				if ( depth ) {									// back to enclosing macro
+					smsFrame *f 	= &frames[--depth];
+					currentMac  	= f->mac;
+					macroPos		= f->pos;
+					macroRepeat		= f->repeat;
+					rec				= f->rec;
+					recOwn			= f->recOwn;
+					cntMACLINE		= f->line;
+					cntMACLINE_WORD	= f->word;
+				} else {
+					P_MACRO 		= IDLE;
+					rec				= NULL;
+					recOwn			= FALSE;
 				}
-				token = parser_next(&SMSWORD, data); cntLINE_WORD++;
+				if ( repeat ) P_REPEAT = repeat - 1;
+				continue;
 			}
 		} else {
-			token = parser_next(&SMSWORD, data);     
+			token = lexer_next(&SMSLEXER, &SMSTOKEN);     
 			cntLINE_WORD++;
+			if ( token != EOD ) SMSWORD = lexer_copy(&SMSTOKEN, SMSWORDBUF);
 		}
 	
 		if ( token == EOD) break;
@@ -1498,12 +4558,12 @@ NEXT_WORD_READY:
 				break;
 			default:
 				// check comments
-				if (strcmp(SMSWORD, "//") == 0)       P_COMMENT  = TRUE;
-				if (strcmp(SMSWORD, "/*") == 0) {
+				if (lexer_isWord(&SMSTOKEN, "//"))       P_COMMENT  = TRUE;
+				if (lexer_isWord(&SMSTOKEN, "/*")) {
 					if (P_BLOCKCOMMENT)			   	{ err = ERR_BLOCKCOMMENT; break; }
 					P_BLOCKCOMMENT = TRUE;
 				}
-				if (strcmp(SMSWORD, "*/") == 0) {
+				if (lexer_isWord(&SMSTOKEN, "*/")) {
 					if (!P_BLOCKCOMMENT)		    { err = ERR_BLOCKCOMMENT; break; }
 					P_BLOCKCOMMENT = FALSE; 
 					P_COMMENT = TRUE;
@@ -1512,29 +4572,35 @@ NEXT_WORD_READY:
 				
 				// check HIDCAM commands
 				if ( cntLINE_WORD == 1 ) {
-					if (strcmp(SMSWORD, "H:") == 0) { P_CMDTYPE  = HEADER; P_NEXTWORD = TRUE; break; }
-					if (strcmp(SMSWORD, "I:") == 0) { P_CMDTYPE  = INST;   P_NEXTWORD = TRUE; break; }
-					if (strcmp(SMSWORD, "D:") == 0) { P_CMDTYPE  = DRUM;   P_NEXTWORD = TRUE; break; }
-					if (strcmp(SMSWORD, "C:") == 0) { P_CMDTYPE  = CHORD;  P_NEXTWORD = TRUE; break; }
-					if (strcmp(SMSWORD, "A:") == 0) { P_CMDTYPE  = ARP;    P_NEXTWORD = TRUE; break; }
-					if (strcmp(SMSWORD, "M:") == 0) { P_CMDTYPE  = MACRO;  P_NEXTWORD = TRUE; break; }
+					if (lexer_isWord(&SMSTOKEN, "H:")) { P_CMDTYPE  = HEADER; P_NEXTWORD = TRUE; break; }
+					if (lexer_isWord(&SMSTOKEN, "I:")) { P_CMDTYPE  = INST;   P_NEXTWORD = TRUE; break; }
+					if (lexer_isWord(&SMSTOKEN, "D:")) { P_CMDTYPE  = DRUM;   P_NEXTWORD = TRUE; break; }
+					if (lexer_isWord(&SMSTOKEN, "C:")) { P_CMDTYPE  = CHORD;  P_NEXTWORD = TRUE; break; }
+					if (lexer_isWord(&SMSTOKEN, "A:")) { P_CMDTYPE  = ARP;    P_NEXTWORD = TRUE; break; }
+					if (lexer_isWord(&SMSTOKEN, "M:")) { P_CMDTYPE  = MACRO;  P_NEXTWORD = TRUE; break; }
 				}
 				break;			
 		}
 
 		if(err) break;
+		
+		// keep compiler state at start of top level line
+		if ( edit && P_MACRO == IDLE && (token == NEWLINE || token == CARRIAGE_RETURN) ) {
+			STATE_GET(st);
+			edit_checkpoint(ctx, &st, sms, SMSLEXER.pos, cntLINE, cntWORD, P_BLOCKCOMMENT);
+		}
 
 		if ( P_NEXTWORD ) continue;
 //		
 // handling system command
 //	
 		P_NEXTWORD = TRUE;
+		if ( rec && P_CMDTYPE != UNKNOWN ) block_noCache(rec);		// definitions in macro
 		switch ( P_CMDTYPE ) {
 			case HEADER:
 				if ( cntLINE_WORD == 2) {
 					if(!parser_isChar(SMSWORD[0]))							{ err = ERR_NAME2; break; }
-					sms->name = (char*)realloc(sms->name, strlen(SMSWORD));
-					strcpy(sms->name, SMSWORD);
+					snprintf(sms->name, BUFFER, "%s", SMSWORD);
 					break;
 				}
 				err = parser_isParameter(SMSWORD, P_CMDTYPE, sms); 
@@ -1542,7 +4608,7 @@ NEXT_WORD_READY:
 			case INST:
 				if ( cntLINE_WORD == 2) { 
 					if(!parser_isChar(SMSWORD[0]))						{ err = ERR_NAME2; break; }
-					currentTrk = newSmsTrk(SMSWORD);
+					currentTrk = newSmsTrk(ctx, SMSTOKEN.ptr, SMSTOKEN.len);
 					if (!currentTrk)  									{ err = ERR_NAME; break; }
 					sms->trks++;
 					break; 
@@ -1552,7 +4618,7 @@ NEXT_WORD_READY:
 			case DRUM:
 				if ( cntLINE_WORD == 2) { 
 					if(!parser_isChar(SMSWORD[0]))						{ err = ERR_NAME2; break; }
-					currentDKey = newSmsDrumKey(SMSWORD);
+					currentDKey = newSmsDrumKey(ctx, SMSTOKEN.ptr, SMSTOKEN.len);
 					if (!currentDKey)  									{ err = ERR_NAME; break; }
 					sms->drumkeys++;
 					break; 
@@ -1564,7 +4630,7 @@ NEXT_WORD_READY:
 			case CHORD:
 				if ( cntLINE_WORD == 2) { 
 					if(!parser_isChar(SMSWORD[0]))						{ err = ERR_NAME2; break; }
-					currentChord = newSmsChord(SMSWORD);
+					currentChord = newSmsChord(ctx, SMSTOKEN.ptr, SMSTOKEN.len);
 					if (!currentChord)  								{ err = ERR_NAME; break; }
 					sms->chords++;
 					break; 
@@ -1579,7 +4645,7 @@ NEXT_WORD_READY:
 			case ARP:
 				if ( cntLINE_WORD == 2) {
 					if(!parser_isChar(SMSWORD[0]))						{ err = ERR_NAME2; break; }
-					currentArp = newSmsMacro(SMSWORD, P_CMDTYPE);
+					currentArp = newSmsMacro(ctx, SMSTOKEN.ptr, SMSTOKEN.len, P_CMDTYPE);
 					if (!currentArp)  									{ err = ERR_NAME; break; }
 					sms->arps++;
 					currentArp->startline = cntLINE;
@@ -1587,24 +4653,18 @@ NEXT_WORD_READY:
 					cntARPLINE_WORD	= 2;
 					break; 
 				}
-				// add word to macro list (without checking)
-				// memory allocation for oldlist + blank + new word + null terminator
+				// add word to arp list (without checking)
 				if ( token == MACRO_START 		||
 					 token == MACRO_END   		||
 					 token == TIME_BLOCK_START 	||
 					 token == TIME_BLOCK_END 	)						{ err = ERR_ARP_SYMBOL; break; }
 					 
-				P_MACRO_COMMANDS = malloc(strlen(currentArp->list) + 1 + strlen(SMSWORD) + 1);
-				strcpy(P_MACRO_COMMANDS, currentArp->list);
-				strcat(P_MACRO_COMMANDS, " ");
-				strcat(P_MACRO_COMMANDS, SMSWORD);
-				free(currentArp->list);
-				currentArp->list = P_MACRO_COMMANDS;
+				addSmsMacroWord(ctx, currentArp, &SMSTOKEN);
 				break;
 			case MACRO:
 				if ( P_MACRO == IDLE && cntLINE_WORD == 2 ) {
 					if(!parser_isChar(SMSWORD[0]))						{ err = ERR_NAME2; break; }
-					currentMac = newSmsMacro(SMSWORD, P_CMDTYPE);
+					currentMac = newSmsMacro(ctx, SMSTOKEN.ptr, SMSTOKEN.len, P_CMDTYPE);
 					if (!currentMac)  									{ err = ERR_NAME; break; }
 					sms->macs++;
 					currentMac->startline = cntLINE;
@@ -1628,17 +4688,8 @@ NEXT_WORD_READY:
 						P_COMMENT 			= TRUE;
 						break;
 					default: {
-						// check nested macro (not allowed)
-						void *p = getObject(SMSWORD, &type);
-						if ( p && type == MACRO) 						{ err = ERR_MACRO_NESTED; break; }
-						// add word to macro list (without checking)
-						// memory allocation for oldlist + blank + new word + null terminator
-						P_MACRO_COMMANDS = malloc(strlen(currentMac->list) + 1 + strlen(SMSWORD) + 1);
-						strcpy(P_MACRO_COMMANDS, currentMac->list);
-						strcat(P_MACRO_COMMANDS, " ");
-						strcat(P_MACRO_COMMANDS, SMSWORD);
-						free(currentMac->list);
-						currentMac->list = P_MACRO_COMMANDS;
+						// add word to macro list (without checking), nested macros are resolved at passing
+						addSmsMacroWord(ctx, currentMac, &SMSTOKEN);
 						break;
 					}
 				}
@@ -1654,24 +4705,26 @@ NEXT_WORD_READY:
 // handling user command
 //
 		smsTrack *trk 	= currentTrk;
-		smsEvent *evt;
 		BYTE status, data1, data2;
 
-		void *p = getObject(SMSWORD, &type);
+		int   id = sym_find(ctx, SMSTOKEN.ptr, SMSTOKEN.len, &type);
+		void *p  = ( id != EMPTY_ID ) ? sym_object(ctx, id) : NULL;
 		if ( p ) {
 			if ( type == INST || type == DRUM ) {
 				if ( type == INST ) {
 					currentTrk = trk = p;
+					if ( rec ) block_switch(ctx, rec, trk, NULL);
 					//set bank
 					status 	= 0xB0 + trk->chn; data1 = 0; data2 = trk->bnk;  
-					evt = newSmsEvent(trk, sms->evts++, sngTime, status, data1, data2);
+					newSmsEvent(ctx, trk, sms->evts++, sngTime, status, data1, data2);
 					//set prg or drum kit
 					status 	= 0xC0 + trk->chn; data1 = trk->prg; data2 = 0;				  
-					evt = newSmsEvent(trk, sms->evts++, sngTime, status, data1, data2);
+					newSmsEvent(ctx, trk, sms->evts++, sngTime, status, data1, data2);
 				}
 				if ( type == DRUM ) {
 					currentDKey  = p;
 					currentTrk   = trk = DrumTrk;
+					if ( rec ) block_switch(ctx, rec, trk, currentDKey);
 				}
 				// timing
 				if(barTime) sngTime += sms->bar - barTime;
@@ -1679,10 +4732,22 @@ NEXT_WORD_READY:
 				continue;
 				
 			} else if ( type == MACRO) {							// macro
-				if(P_MACRO != IDLE)									{ err = ERR_MACRO_NESTED; break; }
-				currentMac 			  = p;
-				P_MACRO_COMMANDS      = (char*)calloc(strlen(currentMac->list)+1, sizeof(char));
-				strcpy(P_MACRO_COMMANDS, currentMac->list);			
+				smsMacro *mac = p;
+				if ( mac->active )									{ err = ERR_MACRO_NESTED; break; }
+				if ( P_MACRO == PASSING ) {							// nested macro, keep enclosing macro
+					if ( depth == depthMax ) {
+						depthMax = ( depthMax ) ? depthMax * 2 : 8;
+						frames   = ctx->frames = (smsFrame*)sms_realloc(ctx, frames, depthMax * sizeof(smsFrame));
+						ctx->framesMax = depthMax;
+					}
+					frames[depth++] = (smsFrame){ currentMac, macroPos, macroRepeat, rec, recOwn, 
+												  cntMACLINE, cntMACLINE_WORD };
+				}
+				currentMac 			  = mac;
+				currentMac->active	  = TRUE;
+				macroPos			  = 0;
+				macroRepeat			  = macroRepeater;
+				macroRepeater		  = 0;
 				P_MACRO      		  = PASSING;
 				SMSWORD         	  = NULL;
 				cntMACLINE 	 		  = 0;
@@ -1695,6 +4760,23 @@ NEXT_WORD_READY:
 				currentTrk->note->vol = 127;
 				currentBaseNote       = EMPTY;
 				P_CMDTYPE			  = UNKNOWN;
+				// replay compiled event block for same entry state, otherwise compile it
+				STATE_GET(st);
+				smsBlock *blk = block_find(ctx, currentMac, &st);
+				recOwn = FALSE;
+				if ( !blk && ctx->cache.dir && currentMac->variants < MACRO_VARIANTS ) 
+					blk = cache_load(ctx, currentMac, &st);
+				if ( blk ) {
+					if ( rec ) block_useBlock(ctx, rec, blk);
+					block_replay(ctx, blk, &st, sms);
+					STATE_SET(st);
+					cntWORD  += blk->words;
+					macroPos  = currentMac->size;
+				} else if ( (blk = block_begin(ctx, currentMac, &st, rec, sms->evts, cntWORD)) ) {
+					rec    = blk;
+					recOwn = TRUE;
+					if ( ctx->cache.dir ) blk->usec = clock_usec();
+				}
 				continue;
 			}
 		}
@@ -1743,20 +4825,20 @@ NEXT_WORD_READY:
 //	
 // process word as other (dynamic) header parameter 
 //
+		if ( rec ) block_useEntryTrk(ctx, rec);
+		int wordClass = parser_classify(SMSWORD);
 		// change tempo with bpm= 
-		err = parser_isBPM(SMSWORD, &value);
+		err = ( wordClass == WORD_BPM ) ? parser_isBPM(SMSWORD, &value) : ERR_DEF_PARAMETER;
 		if(!err) {
-			smsEvent *evt;
-			// send all notes off for channel of current track
-			evt = newSmsEvent(trk, sms->evts++, sngTime, 0xB0, 0x7B, 0);
+				// send all notes off for channel of current track
+			newSmsEvent(ctx, trk, sms->evts++, sngTime, 0xB0, 0x7B, 0);
 			// send tempo change
-			evt = newSmsEvent(trk, sms->evts++, sngTime, 0, 0, 0);
-			evt->bpm = value;
+			newSmsTempo(ctx, trk, sms->evts++, sngTime, value);
 			continue;
 		} else if(err == ERR_VALUE) break;
 		
 		// change bar type with bar=		
-		err = parser_isBAR(SMSWORD, &value);
+		err = ( wordClass == WORD_BAR ) ? parser_isBAR(SMSWORD, &value) : ERR_DEF_PARAMETER;
 		if(!err) {
 			sms->bar = sms->ppqn * value;
 			continue;
@@ -1764,18 +4846,18 @@ NEXT_WORD_READY:
 
 // MIDICC: process word as midi controller
 		int cc, v;
-		err = parser_isMidiCC(SMSWORD, &cc, &v);
+		err = ( wordClass == WORD_MIDICC ) ? parser_isMidiCC(SMSWORD, &cc, &v) : ERR_NO_COMMAND;
 		if ( !err ) {	
 			status  	  = 0xB0 + trk->chn;
 			data1    	  = cc;
 			data2    	  = v;
-			smsEvent *evt = newSmsEvent(trk, sms->evts++, sngTime, status, data1, data2);
+			newSmsEvent(ctx, trk, sms->evts++, sngTime, status, data1, data2);
 			continue; 
 		}
 		if ( err != ERR_NOERROR && err != ERR_NO_COMMAND ) break;
 
 // BASENOTE: process word as base note		
-		int bs = parser_isBaseNote(SMSWORD);
+		int bs = ( wordClass == WORD_NOTE ) ? parser_isBaseNote(SMSWORD) : EMPTY;
 		if(bs == ERR_BASENOTE) { err = bs; break; }
 		err = (bs == EMPTY) ? ERR_NO_COMMAND : ERR_NOERROR;
 		if(!err) { 
@@ -1786,43 +4868,44 @@ NEXT_WORD_READY:
 // NOTE: process word as note
 		int trkType = (trk->chn == 9) ? DRUM : INST;
 		int holdKey = trk->note->hold;
-		if(currentBaseNote == EMPTY) err = parser_isNote( SMSWORD, trk->note, trkType ); 	// key note or drum note
-		if(currentBaseNote != EMPTY) err = parser_isNote( SMSWORD, trk->note, BASENOTE );  	// tab 
+		err = ERR_NO_COMMAND;
+		if(wordClass == WORD_NOTE && currentBaseNote == EMPTY) err = parser_isNote(ctx,  SMSWORD, trk->note, trkType ); 	// key note or drum note
+		if(wordClass == WORD_NOTE && currentBaseNote != EMPTY) err = parser_isNote(ctx,  SMSWORD, trk->note, BASENOTE );  	// tab 
 		if( err != ERR_NOERROR && err != ERR_NO_COMMAND ) break;
 
 		if ( !err ) { 
 			smsNote *n = trk->note;	
-			float dot  = ( n->dot ) ? 1.5 : 1.0;
-			int   dur  = (int)(sms->ppqn * 4 / n->dur * dot);
+			int   dur  = parser_ticks(ctx, sms->ppqn, n->dur, n->dot);
 			if ( grpTimeStart != TIME_OFF ) sngTime = grpTimeStart;
 			// is pause
 			if ( n->key == PAUSE ) {
 				sngTime += dur;
 				barTime += dur;
 				if(holdKey != EMPTY)
-					evt = newSmsEvent(trk, sms->evts++, sngTime, 0x80 + trk->chn, holdKey, 0);
+					newSmsEvent(ctx, trk, sms->evts++, sngTime, 0x80 + trk->chn, holdKey, 0);
 			} else {
 				// set note on
 				status = 0x90 + trk->chn;
+				if(currentBaseNote == EMPTY && n->key == BEAT && rec) block_useEntryDKey(rec);
 				if(currentBaseNote == EMPTY) data1  = ( n->key == BEAT) ? currentDKey->key : n->key + n->hft + n->oct * 12;
 				if(currentBaseNote != EMPTY) data1  = n->key + currentBaseNote;
 				if(data1 > 128) { err = ERR_NOTE ; break;	}
 				data2 = n->vol;
-				evt = newSmsEvent(trk, sms->evts++, sngTime, status, data1, data2);
+				newSmsEvent(ctx, trk, sms->evts++, sngTime, status, data1, data2);
 				// set current note off
 				sngTime    += dur;
 				barTime    += dur;
 				status    	= 0x80 + trk->chn;
 				
 				if(n->hold == EMPTY) {
-					evt = newSmsEvent(trk, sms->evts++, sngTime-MIDI_TIME_DIV , status, data1, data2);
+					newSmsEvent(ctx, trk, sms->evts++, sngTime-MIDI_TIME_DIV , status, data1, data2);
 				} else {
 					n->hold 		 = data1;
 				}
 				
 				// set last hold note off
 				if(holdKey != EMPTY)
-					evt = newSmsEvent(trk, sms->evts++, sngTime-MIDI_TIME_DIV , status, holdKey, 0);
+					newSmsEvent(ctx, trk, sms->evts++, sngTime-MIDI_TIME_DIV , status, holdKey, 0);
 			} 	
 			
 			// handling blocks and time groups
@@ -1834,10 +4917,10 @@ NEXT_WORD_READY:
 	
 // CHORD: process word as key chord and arp
 		smsChordNote *c = trk->cnote;
-		err = parser_isChord(SMSWORD, c);	
+		err = ( wordClass == WORD_CHORD ) ? parser_isChord(ctx, SMSWORD, c) : ERR_NO_COMMAND;	
 		if(err) { err = ERR_NO_COMMAND ; break;	}				// word is not a chord
 
-		BYTE *ckeys     = c->chord->keys;
+		const BYTE *ckeys = c->chord;
 
 		// chord play without arp, all tones as 1/1 notes at same time
 		if (!c->arp) {
@@ -1847,10 +4930,10 @@ NEXT_WORD_READY:
 				status 	= 0x90 + trk->chn;
 				data1   = (CHORD_OCTAVE * 12) + c->key + c->hft + ckeys[i]; 
 				data2 	= 127;
-				evt = newSmsEvent(trk, sms->evts++, sngTime + delay, status, data1, data2);
+				newSmsEvent(ctx, trk, sms->evts++, sngTime + delay, status, data1, data2);
 
 				status 	= 0x80 + trk->chn;
-				evt = newSmsEvent(trk, sms->evts++, sngTime-MIDI_TIME_DIV  + sms->bar, status, data1, data2);
+				newSmsEvent(ctx, trk, sms->evts++, sngTime-MIDI_TIME_DIV  + sms->bar, status, data1, data2);
 			}
 			sngTime += sms->bar;
 			barTime += sms->bar;
@@ -1862,76 +4945,69 @@ NEXT_WORD_READY:
 			continue;
 		} 
 		
-		// chord play with arp
+		// chord play with arp, steps of arp are compiled once
 		if(c->arp) {
-			char *arplist	= c->arp->list;
-			smsNote *n      = newSmsNote();
-			n->oct          = 0;
-			ARPWORD			= (char*)calloc(64, sizeof(char));
-			P_EVENTTYPE 	= ARP;
-			cntARPLINE_WORD = 2;
-
-			while (strlen(arplist)) {
-				cntARPLINE_WORD++;
-				int res  = sscanf(arplist, "%s", ARPWORD);
-				int size = strlen(ARPWORD);
-				arplist = arplist + size + 1;
+			smsMacro *arp = c->arp;
+			if ( !arp->step || arp->stepPpqn != sms->ppqn ) parser_compileArp(ctx, arp, sms->ppqn);
+			P_EVENTTYPE = ARP;
+
+			int w;
+			for ( w = 0; w < arp->steps; w++ ) {
+				smsArpStep *step = &arp->step[w];
 
 				// handling blocks and time groups
-				if ( size == 1 && ARPWORD[0] == TIME_GROUP_START ) {
+				if ( step->type == TIME_GROUP_START ) {
 					if (P_TIMEGROUP != IDLE) 						{ err = ERR_TIME_GROUP; break; }
 					P_TIMEGROUP  = PASSING;
 					grpTimeStart = grpTimeEnd = sngTime;
 					grpTimeBar	 = barTime;
 					continue;
-				} else if ( size == 1 && ARPWORD[0] == TIME_GROUP_END ) {
+				} else if ( step->type == TIME_GROUP_END ) {
 					if (P_TIMEGROUP != PASSING) 					{ err = ERR_TIME_GROUP; break; }
 					P_TIMEGROUP  = IDLE;
 					sngTime  	 = grpTimeEnd;
 					barTime      = grpTimeBar + (grpTimeEnd - grpTimeStart);
 					grpTimeStart = grpTimeEnd = TIME_OFF;
 					continue;
-				} else if ( size == 1 && ARPWORD[0] == BARLINE ) {
+				} else if ( step->type == BARLINE ) {
 					if (P_TIMEGROUP == PASSING) 					{ err = ERR_TIME_GROUP; break; }
 					if(barTime > sms->bar) 							{ err = ERR_BAR; break; }
 					if(barTime) sngTime += sms->bar - barTime;
 					barTime  = 0;
 					trk->note->dot = 0;
 					continue;
+				} else if ( step->type == UNKNOWN ) {				// invalid arp word
+					err = step->err; 
+					break;
 				}
 			
 				// play arpeggio		
-				err = parser_isNote( ARPWORD, n, ARP );
-				if (err) break;
-
-				int   oct   = CHORD_OCTAVE + n->oct;
-				if(oct < 1 || oct > 10 ) 	{ err = ERR_OCTAVE; break; }
-				float dot 	= ( n->dot ) ? 1.5 : 1.0;
-				int   dur 	= (int)(sms->ppqn * 4 / n->dur * dot);
-
-				if ( n->key == PAUSE || n->key == EMPTY) {	// is pause
-					sngTime += dur;
-					barTime += dur;
+				if ( step->type == PAUSE ) {								// is pause
+					sngTime += step->dur;
+					barTime += step->dur;
 				} else {													// is note
-					if (oct < 1 || oct > 10) { err = ERR_OCTAVE; break; }
 					// set note on
 					status 	= 0x90 + trk->chn;
-					data1 = (oct * 12) + c->key + c->hft + ckeys[n->key];
-					data2 	= n->vol;
+					data1   = (step->oct * 12) + c->key + c->hft + ckeys[step->key];
+					data2 	= step->vol;
 					if ( grpTimeStart != TIME_OFF )  sngTime = grpTimeStart;
-					evt = newSmsEvent(trk, sms->evts++, sngTime, status, data1, data2);
+					newSmsEvent(ctx, trk, sms->evts++, sngTime, status, data1, data2);
 					// set note off
-					sngTime  += dur;
-					barTime  += dur;
+					sngTime  += step->dur;
+					barTime  += step->dur;
 					status    = 0x80 + trk->chn;
-					evt = newSmsEvent(trk, sms->evts++, sngTime, status, data1, data2);
+					newSmsEvent(ctx, trk, sms->evts++, sngTime, status, data1, data2);
 				}
 				// handling blocks and time groups
 				if ( P_TIMEBLOCK == PASSING && blkTimeEnd < sngTime ) blkTimeEnd = sngTime;
 				if ( P_TIMEGROUP == PASSING && grpTimeEnd < sngTime ) grpTimeEnd = sngTime;		
 			} 
 
-			if (err) break;
+			if (err) {												// position of arp word
+				cntARPLINE_WORD = w + 3;
+				lexer_copy(&arp->list[w], ARPWORD);
+				break;
+			}
 			P_EVENTTYPE = UNKNOWN;
 			
 			lastWordType = CHORD;
@@ -1945,7 +5021,7 @@ NEXT_WORD_READY:
 // ----------------------------------------------------------------------------------------
 	// generate successful message
 	char *buf = (char*)calloc(1024, sizeof(char));
-	char *str = (char*)calloc(1024, sizeof(char));
+	char  str[1024];
 	if ( !err && P_MACRO 	 == DEFINING)	err = ERR_MACRO_BRACES;
 	if ( !err && P_TIMEBLOCK == PASSING)    err = ERR_TIME_BLOCK;
 	if ( P_BLOCKCOMMENT)					err = ERR_BLOCKCOMMENT;
@@ -1955,20 +5031,31 @@ NEXT_WORD_READY:
 		if(barTime) sngTime += sms->bar - barTime;
 		currentTrk->note->dot = 0;
 		// send all notes off for channel of current track
-		smsEvent *evt = newSmsEvent(currentTrk, sms->evts++, sngTime, 0xB0, 0x7B, 0);
+		newSmsEvent(ctx, currentTrk, sms->evts++, sngTime, 0xB0, 0x7B, 0);
 	}
 
 	if ( !err ) {
 		sprintf(str, "compiler result:\n");											strcat(buf, str);
 		sprintf(str, "song '%s' ", sms->name); 								strcat(buf, str);
 		sprintf(str, "lines %i words %i\n",  cntLINE, cntWORD); 			strcat(buf, str);
+		sprintf(str, "word cache hits %i misses %i\n", ctx->memo.hits, ctx->memo.misses);	strcat(buf, str);
+		if ( ctx->cache.stats ) {
+			sprintf(str, "compile cache hits %i misses %i stores %i ", ctx->cache.hits, ctx->cache.misses, ctx->cache.stores); 
+																			strcat(buf, str);
+			sprintf(str, "time saved %.1f ms (cache io %.1f ms)\n", ctx->cache.saved / 1000.0, ctx->cache.io / 1000.0);
+																			strcat(buf, str);
+		}
 		sprintf(str, "bpm %i ppqn %i ",sms->bpm, sms->ppqn);				strcat(buf, str);
 		sprintf(str, "tracks %i drumkeys %i\n", sms->trks, sms->drumkeys); 	strcat(buf, str);
 		sprintf(str, "chordtypes %i ", sms->chords);  						strcat(buf, str);
 		sprintf(str, "macros %i events %i", sms->macs, sms->evts);			strcat(buf, str);
 		*msg = buf;
-		struct BUF *smf = parser_createMidi(sms);
-		freeSMS(sms);
+		struct BUF *smf = parser_createMidi(ctx, sms, fd);
+		if ( !smf && fd >= 0 ) {
+			sprintf(str, "\nerr-message: %s", ERRMSG[ERR_WRITE_FILE]);		strcat(buf, str);
+		}
+		if ( bar ) *bar = sms->bar;
+		if ( !edit ) freeSMS(ctx);
 		return smf;
 	}
 
@@ -1978,13 +5065,17 @@ NEXT_WORD_READY:
 		sprintf(str, "%s\n", ERRMSG[err]);									strcat(buf, str);
 	} else {
 		sprintf(str, "line %3i pos %2i ", cntLINE, cntLINE_WORD);			strcat(buf, str);				
+		for ( int i = 0; i < depth; i++ ) {									// enclosing macros
+			sprintf(str, "macro '%s'\n", sym_name(ctx, frames[i].mac->id));		strcat(buf, str);
+			int mline = frames[i].line + frames[i].mac->startline;
+			sprintf(str, "line %3i pos %2i ", mline, frames[i].word);		strcat(buf, str);
+		}
 		if ( P_MACRO == PASSING ) {
-			sprintf(str, "macro '%s'\n", currentMac->name);					strcat(buf, str);
+			sprintf(str, "macro '%s'\n", sym_name(ctx, currentMac->id));					strcat(buf, str);
 			int mline = cntMACLINE+currentMac->startline;
 			sprintf(str, "line %3i pos %2i ", mline, cntMACLINE_WORD);		strcat(buf, str);
 		}
 		if ( P_EVENTTYPE == ARP ) {
-			char *arpname = currentTrk->cnote->arp->name;
 			sprintf(str, "arp '%s'\n", SMSWORD);							strcat(buf, str);
 			int mline = currentTrk->cnote->arp->startline;
 			sprintf(str, "line %3i pos %2i ", mline, cntARPLINE_WORD);		strcat(buf, str);
@@ -1993,7 +5084,81 @@ NEXT_WORD_READY:
 		sprintf(str, "word '%s'\nerr-message: %s", SMSWORD, ERRMSG[err]);	strcat(buf, str);
 	}
 	*msg = buf;
-	freeSMS(sms);
+	// free event blocks in compiling
+	if ( recOwn ) block_free(ctx, rec);
+	for ( int i = 0; i < depth; i++ ) if ( frames[i].recOwn ) block_free(ctx, frames[i].rec);
+	if ( !edit ) freeSMS(ctx);
 	return NULL;
 }
 
+// compile sms script to SMF buffer, ctx NULL: temporary compiler context
+struct BUF *sms2midi(smsCtx *ctx, char *data, int len, char **msg) {  
+	return sms2midiBar(ctx, data, len, msg, NULL);
+}
+
+// compile sms script to SMF buffer, bar: bar length in ticks at end of script (e.g. live playback)
+struct BUF *sms2midiBar(smsCtx *ctx, char *data, int len, char **msg, int *bar) {  
+	smsCtx *tmp = ( ctx ) ? NULL : newSmsCtx(NULL);
+	struct BUF *smf = parser_sms2midi(( ctx ) ? ctx : tmp, data, len, msg, -1, bar, FALSE, NULL);
+	if ( tmp ) freeSmsCtx(tmp);
+	return smf;
+}
+
+// compile sms script again after an edit, continues at the last unchanged top level line,
+// from: line of continuing (1 if compiled from start), bar: bar length at end of script
+struct BUF *sms2midiEdit(smsCtx *ctx, char *data, int len, char **msg, int *bar, int *from) {  
+	return parser_sms2midi(ctx, data, len, msg, -1, bar, TRUE, from);
+}
+
+// drop compiler state kept for edits
+void sms2midiEditEnd(smsCtx *ctx) {
+	if ( ctx->edits.kept ) freeSMS(ctx);
+	edit_end(ctx);
+	return;
+}
+
+// compile sms script and write midi file to file descriptor (file, pipe or stdout)
+// without assembling it in memory, returns TRUE if midi file is written
+int sms2midiStream(smsCtx *ctx, char *data, int len, char **msg, int fd) {
+	smsCtx *tmp = ( ctx ) ? NULL : newSmsCtx(NULL);
+	struct BUF *mthd = parser_sms2midi(( ctx ) ? ctx : tmp, data, len, msg, fd, NULL, FALSE, NULL);
+	if ( tmp ) freeSmsCtx(tmp);
+	freeBUF(mthd);
+	return ( mthd != NULL );
+}
+
+// free compiler context and all memory kept for next compiling
+void freeSmsCtx(smsCtx *ctx) {
+	if ( !ctx ) return;
+	freeObjects(ctx);
+	for ( int t = 0; t < SPARE_TYPES; t++ ) freeSpare(ctx, t);
+	sms_free(ctx, ctx->symtab.sym);
+	sms_free(ctx, ctx->symtab.slot);
+	sms_free(ctx, ctx->symtab.names);
+	freeMemo(ctx);
+	freeEvents(ctx, &ctx->events);
+	freeEvents(ctx, &ctx->tempo);
+	freeEvents(ctx, &ctx->cache.flat);
+	sms_free(ctx, ctx->cache.buf);
+	sms_free(ctx, ctx->edits.data);
+	sms_free(ctx, ctx->edits.cp);
+	sms_free(ctx, ctx->edits.trk);
+	sms_free(ctx, ctx->frames);
+	for ( int t = 0; t < ctx->trksMax; t++ ) {
+		smsTrkJob *job = &ctx->job[t];
+		freeEvents(ctx, &ctx->bucket[t]);
+		sms_free(ctx, job->order);
+		sms_free(ctx, job->tmp);
+		sms_free(ctx, job->run);
+		sms_free(ctx, job->key);
+	}
+	sms_free(ctx, ctx->bucket);
+	sms_free(ctx, ctx->job);
+	sms_free(ctx, ctx->trkKey);
+	sms_free(ctx, ctx->slot);
+	freeTRKs(&ctx->trks);
+	smsAlloc mem = ctx->mem;
+	mem.func(mem.arg, ctx, 0);
+	return;
+}
+
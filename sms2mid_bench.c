@@ -0,0 +1,75 @@
+// sms2mid_bench.c
+// 		HIDCAM ma.ke.
+//
+// 		benchmark of event sorting in parser_createMidi:
+// 		the song part of a script (after the last definition) is repeated
+// 		n times and compiled with qsort and with the natural merge sort
+//
+//		tcc sms2mid_bench.c
+//		sms2mid_bench [input.sms] [n]		default: sms/JayDrub_upd.sms 1000
+//
+
+#include <time.h>
+
+#include "sms2mid.h"		// midi and sms api for simple music script language
+
+// compile script, returns SMF buffer and time in ms
+struct BUF *compile(smsCtx *ctx, char *data, int len, double *ms) {
+	char   *msg;
+	clock_t start    = clock();
+	struct BUF *smf  = sms2midi(ctx, data, len, &msg);
+	*ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+	printf("%s\n", msg);
+	free(msg);
+	return smf;
+}
+
+/***************************************************************************
+ * main function
+ ***************************************************************************/
+
+int main(int argc, char **argv) {
+	char *fileName = ( argc > 1 ) ? argv[1] : "sms/JayDrub_upd.sms";
+	int   n        = ( argc > 2 ) ? atoi(argv[2]) : 1000;
+
+	smsFile *file = get_file_to_mem(fileName);
+	if ( !file ) {
+		printf("%s '%s'\n", ERRMSG[ERR_OPEN_FILE], fileName);
+		return -2;
+	}
+
+	// song part starts after the line closing the last macro definition
+	int song = 0;
+	for ( int i = 0; i + 1 < file->len; i++ )
+		if ( file->data[i] == '\n' && file->data[i + 1] == MACRO_END ) song = i + 1;
+	while ( song < file->len && file->data[song] != '\n' ) song++;
+
+	// script with n times the song part
+	int   songLen = file->len - song;
+	int   len     = song + songLen * n;
+	char *data    = (char*)malloc(len);
+	memcpy(data, file->data, song);
+	for ( int i = 0; i < n; i++ ) memcpy(data + song + i * songLen, file->data + song, songLen);
+	printf("'%s' song part %i times, script %i bytes\n", fileName, n, len);
+
+	double  msGeneric, msMerge;
+	smsCtx *ctx = newSmsCtx(NULL);
+	ctx->sortGeneric = TRUE;
+	struct BUF *smfGeneric = compile(ctx, data, len, &msGeneric);
+	ctx->sortGeneric = FALSE;
+	struct BUF *smfMerge   = compile(ctx, data, len, &msMerge);
+	freeSmsCtx(ctx);
+	if ( !smfGeneric || !smfMerge ) return -2;
+
+	int same = smfGeneric->cnt == smfMerge->cnt && memcmp(smfGeneric->mem, smfMerge->mem, smfMerge->cnt) == 0;
+	printf("qsort        %8.1f ms\n", msGeneric);
+	printf("natural merge%8.1f ms\n", msMerge);
+	printf("speedup      %8.2f\n", ( msMerge > 0 ) ? msGeneric / msMerge : 0.0);
+	printf("midi data %s\n", ( same ) ? "identical" : "DIFFERENT");
+
+	freeBUF(smfGeneric);
+	freeBUF(smfMerge);
+	free(data);
+	clear_mem(file);
+	return ( same ) ? 0 : -1;
+}